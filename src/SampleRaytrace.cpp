@@ -44,6 +44,7 @@ void render() {
 	// scene.camera = new OrthographicCamera(cameraPos, cameraFocus, cameraUp, width, height, 0.1);
 
 	rayTrace.raytraceScene(frameBuffer, 0, scene);
+	frameBuffer.showColorBuffer();
 
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
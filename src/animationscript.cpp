@@ -0,0 +1,113 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "animationscript.h"
+
+/**
+ * @fn	void AnimationScript::bind(const std::string& name, double* values, int count)
+ * @brief	Names count consecutive variables, so the script can animate them.
+ * @param	name  	The parameter's name in the script.
+ * @param	values	The first variable.
+ * @param	count 	Number of variables, and of values on each of its lines.
+ */
+
+void AnimationScript::bind(const std::string& name, double* values, int count) {
+	Parameter& parameter = parameters[name];
+	parameter.values = values;
+	parameter.count = count;
+	parameter.keys.clear();
+}
+
+/**
+ * @fn	bool AnimationScript::load(const std::string& fileName)
+ * @brief	Reads the keyframes from a file, replacing any already loaded.
+ * @param	fileName	Name of the file.
+ * @return	False if the file could not be read, or a line names an unbound
+ * 			parameter or has the wrong number of values.
+ */
+
+bool AnimationScript::load(const std::string& fileName) {
+	std::ifstream input(fileName);
+	if (!input) {
+		std::cerr << "Cannot read " << fileName << endl;
+		return false;
+	}
+	for (auto& entry : parameters) {
+		entry.second.keys.clear();
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(input, line); lineNumber++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		Keyframe key;
+		std::string name;
+		if (!(fields >> key.frame)) {
+			if (line.find_first_not_of(" \t\r") == std::string::npos) {
+				continue;
+			}
+			std::cerr << fileName << ":" << lineNumber << ": expected a frame number" << endl;
+			return false;
+		}
+		if (!(fields >> name)) {
+			std::cerr << fileName << ":" << lineNumber << ": expected a parameter name" << endl;
+			return false;
+		}
+		auto entry = parameters.find(name);
+		if (entry == parameters.end()) {
+			std::cerr << fileName << ":" << lineNumber << ": unknown parameter '" << name << "'" << endl;
+			return false;
+		}
+		double value;
+		while (fields >> value) {
+			key.values.push_back(value);
+		}
+		if (!fields.eof() || (int)key.values.size() != entry->second.count) {
+			std::cerr << fileName << ":" << lineNumber << ": " << name << " takes "
+				<< entry->second.count << " numbers" << endl;
+			return false;
+		}
+		entry->second.keys.push_back(key);
+	}
+	for (auto& entry : parameters) {
+		std::stable_sort(entry.second.keys.begin(), entry.second.keys.end(),
+			[](const Keyframe& a, const Keyframe& b) { return a.frame < b.frame; });
+	}
+	return true;
+}
+
+/**
+ * @fn	void AnimationScript::apply(int frame) const
+ * @brief	Sets every scripted parameter to its value at a frame.
+ * @param	frame	The frame number.
+ */
+
+void AnimationScript::apply(int frame) const {
+	for (const auto& entry : parameters) {
+		const Parameter& parameter = entry.second;
+		const vector<Keyframe>& keys = parameter.keys;
+		if (keys.empty()) {
+			continue;
+		}
+		auto after = std::upper_bound(keys.begin(), keys.end(), frame,
+			[](int f, const Keyframe& key) { return f < key.frame; });
+		if (after == keys.begin() || after == keys.end()) {
+			const Keyframe& key = after == keys.begin() ? keys.front() : keys.back();
+			std::copy(key.values.begin(), key.values.end(), parameter.values);
+			continue;
+		}
+		const Keyframe& before = *(after - 1);
+		double t = (double)(frame - before.frame) / (after->frame - before.frame);
+		for (int i = 0; i < parameter.count; i++) {
+			parameter.values[i] = glm::mix(before.values[i], after->values[i], t);
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <map>
+#include "defs.h"
+
+/**
+ * @struct	AnimationScript
+ * @brief	Per-frame values of named parameters, read from a text file of
+ * 			keyframes. Each line is "frame name value...", and '#' starts a
+ * 			comment. Between its keyframes a parameter is linearly interpolated;
+ * 			before the first and after the last it holds. Each name is bound to
+ * 			the variables it drives before the script is loaded, and apply()
+ * 			sets them for a frame. Unscripted parameters are left alone.
+ */
+
+struct AnimationScript {
+	void bind(const std::string& name, double* values, int count);
+	void bind(const std::string& name, dvec3& v) { bind(name, &v.x, 3); }
+	void bind(const std::string& name, double& v) { bind(name, &v, 1); }
+	bool load(const std::string& fileName);
+	void apply(int frame) const;
+protected:
+	/**
+	 * @struct	Keyframe
+	 * @brief	A parameter's values at one frame.
+	 */
+	struct Keyframe {
+		int frame;				//!< Frame number
+		vector<double> values;	//!< One value per bound variable
+	};
+	/**
+	 * @struct	Parameter
+	 * @brief	A bound parameter and its keyframes, in frame order.
+	 */
+	struct Parameter {
+		double* values;			//!< The variables it drives
+		int count;				//!< Number of variables
+		vector<Keyframe> keys;	//!< Its keyframes
+	};
+	std::map<std::string, Parameter> parameters;	//!< Parameters by name
+};
@@ -0,0 +1,227 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// Times drawFilledTriangle on random triangles of several sizes, against the
+// rasterizer it replaced, which evaluated and divided all three edge functions
+// at every pixel of the unclipped bounding box. Both draw into their own
+// framebuffer, and the pixels they disagree on are counted. Some triangles
+// poke out of the window, as they do in real scenes. Slivers are long, thin
+// diagonal triangles, whose bounding boxes are mostly empty, and the floor is
+// a quad that fills the window, like a ground plane. Finally the whole batch
+// is drawn with drawManyFilledTriangles, which bins the triangles and draws
+// the bins in parallel, and compared with drawing them one at a time. The
+// binned batch is then drawn again with deferred shading, into a G-buffer that
+// is lit afterwards, and compared with the forward image. The overdraw scene
+// stacks window-filling layers back to front, so every layer passes the depth
+// test; forward shading lights each pixel once per layer, deferred only once.
+
+#include <chrono>
+#include <random>
+#include "defs.h"
+#include "framebuffer.h"
+#include "rasterization.h"
+#include "threadpool.h"
+
+const int PASSES = 5;
+const int OVERDRAW_LAYERS = 32;
+const int TRIANGLES = 2000;
+
+typedef void (*TriangleFunction)(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const VertexData& v0, const VertexData& v1, const VertexData& v2,
+	const Material& material, const Frame& eyeFrame);
+
+double edge(const dvec4& p, const dvec4& q, double x, double y) {
+	return (p.y - q.y) * x + (q.x - p.x) * y + (p.x * q.y) - (q.x * p.y);
+}
+
+void referenceFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const VertexData& v0, const VertexData& v1, const VertexData& v2,
+	const Material& material, const Frame& eyeFrame) {
+	double xMin = glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x));
+	double xMax = glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x));
+	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
+	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
+
+	double fAlpha = edge(v1.pos, v2.pos, v0.pos.x, v0.pos.y);
+	double fBeta = edge(v2.pos, v0.pos, v1.pos.x, v1.pos.y);
+	double fGamma = edge(v0.pos, v1.pos, v2.pos.x, v2.pos.y);
+	const int materialId = frameBuffer.getMaterialId(&material);
+
+	vector<Fragment> rowFragments;
+	for (double y = yMin; y <= yMax; y++) {
+		for (double x = xMin; x <= xMax; x++) {
+			double alpha = edge(v1.pos, v2.pos, x, y) / fAlpha;
+			double beta = edge(v2.pos, v0.pos, x, y) / fBeta;
+			double gamma = edge(v0.pos, v1.pos, x, y) / fGamma;
+			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
+				if ((alpha > 0 || fAlpha * edge(v1.pos, v2.pos, -1, -1) > 0) &&
+					(beta > 0 || fBeta * edge(v2.pos, v0.pos, -1, -1) > 0) &&
+					(gamma > 0 || fGamma * edge(v0.pos, v1.pos, -1, -1) > 0)) {
+					Fragment fragment;
+					fragment.material = &material;
+					fragment.materialId = materialId;
+					fragment.worldNormal = alpha * v0.normal + beta * v1.normal + gamma * v2.normal;
+					fragment.worldPos = alpha * v0.worldPos + beta * v1.worldPos + gamma * v2.worldPos;
+					double z = alpha * v0.pos.z + beta * v1.pos.z + gamma * v2.pos.z;
+					fragment.windowPos = dvec3(x, y, z);
+					rowFragments.push_back(fragment);
+				}
+			}
+		}
+		FragmentOps::processFragmentSpan(frameBuffer, eyePos, lights, rowFragments, eyeFrame);
+		rowFragments.clear();
+	}
+}
+
+vector<VertexData> makeTriangles(double size, int W, int H, std::mt19937& rng,
+	vector<Material>& materials) {
+	std::uniform_real_distribution<double> centerX(-0.05 * W, 1.05 * W);
+	std::uniform_real_distribution<double> centerY(-0.05 * H, 1.05 * H);
+	std::uniform_real_distribution<double> offset(-size / 2, size / 2);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	vector<VertexData> vertices;
+	for (int t = 0; t < TRIANGLES; t++) {
+		dvec2 center(centerX(rng), centerY(rng));
+		materials.push_back(Material(color(unit(rng), unit(rng), unit(rng))));
+		for (int i = 0; i < 3; i++) {
+			dvec4 pos(center.x + offset(rng), center.y + offset(rng), unit(rng), 1.0);
+			vertices.push_back(VertexData(pos, Z_AXIS, dvec3(pos)));
+		}
+	}
+	return vertices;
+}
+
+vector<VertexData> makeSlivers(double length, double width, int W, int H, std::mt19937& rng,
+	vector<Material>& materials) {
+	std::uniform_real_distribution<double> startX(0.0, W - length / 2);
+	std::uniform_real_distribution<double> startY(0.0, H - length / 2);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	vector<VertexData> vertices;
+	for (int t = 0; t < TRIANGLES / 10; t++) {
+		dvec2 a(startX(rng), startY(rng));
+		dvec2 b = a + length / 2 * dvec2(1.0, 0.5 + unit(rng));
+		dvec2 c = b + width * glm::normalize(dvec2(1.0, -1.0));
+		materials.push_back(Material(color(unit(rng), unit(rng), unit(rng))));
+		for (const dvec2& p : { a, b, c }) {
+			dvec4 pos(p.x, p.y, unit(rng), 1.0);
+			vertices.push_back(VertexData(pos, Z_AXIS, dvec3(pos)));
+		}
+	}
+	return vertices;
+}
+
+vector<VertexData> makeFloor(int W, int H, vector<Material>& materials) {
+	const dvec4 corners[4] = { dvec4(-10, -10, 0.5, 1), dvec4(W + 10, -10, 0.5, 1),
+		dvec4(W + 10, H + 10, 0.5, 1), dvec4(-10, H + 10, 0.5, 1) };
+	vector<VertexData> vertices;
+	for (int i : { 0, 1, 2, 0, 2, 3 }) {
+		vertices.push_back(VertexData(corners[i], Z_AXIS, dvec3(corners[i])));
+	}
+	materials.assign(2, brass);
+	return vertices;
+}
+
+vector<VertexData> makeOverdraw(int W, int H, std::mt19937& rng, vector<Material>& materials) {
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	vector<VertexData> vertices;
+	for (int layer = 0; layer < OVERDRAW_LAYERS; layer++) {
+		const double z = 1.0 - (layer + 1.0) / (OVERDRAW_LAYERS + 1.0);
+		const dvec4 corners[4] = { dvec4(-10, -10, z, 1), dvec4(W + 10, -10, z, 1),
+			dvec4(W + 10, H + 10, z, 1), dvec4(-10, H + 10, z, 1) };
+		const Material material(color(unit(rng), unit(rng), unit(rng)));
+		for (int i : { 0, 1, 2, 0, 2, 3 }) {
+			vertices.push_back(VertexData(corners[i], Z_AXIS, dvec3(corners[i])));
+		}
+		materials.push_back(material);
+		materials.push_back(material);
+	}
+	return vertices;
+}
+
+double timeTriangles(TriangleFunction draw, FrameBuffer& frameBuffer,
+	const vector<VertexData>& vertices, const vector<Material>& materials) {
+	const vector<LightSourcePtr> lights;
+	const Frame eyeFrame;
+	const dvec3 eyePos;
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < PASSES; pass++) {
+		frameBuffer.clearColorAndDepthBuffers();
+		for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+			draw(frameBuffer, eyePos, lights, vertices[i], vertices[i + 1], vertices[i + 2],
+				materials[i / 3], eyeFrame);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / PASSES;
+}
+
+double timeBinned(FrameBuffer& frameBuffer, const vector<VertexData>& vertices,
+	const vector<Material>& materials) {
+	const vector<LightSourcePtr> lights;
+	const Frame eyeFrame;
+	const dvec3 eyePos;
+	vector<const Material*> triangleMaterials;
+	for (const Material& material : materials) {
+		triangleMaterials.push_back(&material);
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < PASSES; pass++) {
+		frameBuffer.clearColorAndDepthBuffers();
+		drawManyFilledTriangles(frameBuffer, eyePos, lights, vertices, triangleMaterials, eyeFrame);
+		FragmentOps::shadeDeferred(frameBuffer, eyePos, lights, eyeFrame);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / PASSES;
+}
+
+int countDifferences(const FrameBuffer& a, const FrameBuffer& b) {
+	const GLubyte* pa = a.getRowMajorColorBuffer();
+	const GLubyte* pb = b.getRowMajorColorBuffer();
+	int differences = 0;
+	for (int i = 0; i < a.getWindowWidth() * a.getWindowHeight(); i++) {
+		if (pa[3 * i] != pb[3 * i] || pa[3 * i + 1] != pb[3 * i + 1] || pa[3 * i + 2] != pb[3 * i + 2]) {
+			differences++;
+		}
+	}
+	return differences;
+}
+
+int main(int argc, char* argv[]) {
+	const double sizes[] = { 4, 16, 64, 256 };
+	const char* sizeNames[] = { "tiny (4 pixels)", "small (16 pixels)", "medium (64 pixels)",
+		"large (256 pixels)", "slivers", "floor", "overdraw" };
+	const int W = 2 * WINDOW_WIDTH;
+	const int H = 2 * WINDOW_HEIGHT;
+	FrameBuffer reference(W, H);
+	FrameBuffer incremental(W, H);
+	FrameBuffer binned(W, H);
+	FrameBuffer deferred(W, H);
+	deferred.setDeferred(true);
+	std::mt19937 rng(386);
+
+	for (int s = 0; s < 7; s++) {
+		vector<Material> materials;
+		vector<VertexData> vertices = s < 4 ? makeTriangles(sizes[s], W, H, rng, materials) :
+			s == 4 ? makeSlivers(H, 6, W, H, rng, materials) :
+			s == 5 ? makeFloor(W, H, materials) : makeOverdraw(W, H, rng, materials);
+		double before = timeTriangles(referenceFilledTriangle, reference, vertices, materials);
+		double after = timeTriangles(drawFilledTriangle, incremental, vertices, materials);
+		double parallel = timeBinned(binned, vertices, materials);
+		double lighted = timeBinned(deferred, vertices, materials);
+		cout << sizeNames[s] << ": " << vertices.size() / 3 << " triangles, "
+			<< before << " -> " << after << " ms/frame, speedup " << before / after
+			<< ", " << countDifferences(reference, incremental) << " pixels differ; binned on "
+			<< ThreadPool::shared().getNumThreads() << " threads " << parallel << " ms/frame, "
+			<< countDifferences(incremental, binned) << " pixels differ; deferred "
+			<< lighted << " ms/frame, " << countDifferences(binned, deferred) << " pixels differ" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// Compares the texel layouts of Image on textured scenes. Each scene is ray cast
+// once to record the (u, v) stream that the ray tracer produces, and then that
+// stream is replayed against every layout. Only texture sampling is timed.
+// The second camera is rolled 90 degrees, so successive pixels in a scanline
+// move mostly in v. The distant camera minifies the textures, so successive
+// lookups are several texels apart.
+
+#include <chrono>
+#include "defs.h"
+#include "io.h"
+#include "ishape.h"
+#include "camera.h"
+#include "image.h"
+
+const int PASSES = 20;
+
+struct TexelLookup {
+	const Image* texture;
+	double u, v;
+};
+
+vector<TexelLookup> recordLookups(const vector<VisibleIShapePtr>& objs,
+	const RaytracingCamera& camera, const vector<Image*>& textures,
+	const vector<Image*>& replacements) {
+	vector<TexelLookup> lookups;
+	for (int y = 0; y < camera.getNY(); y++) {
+		for (int x = 0; x < camera.getNX(); x++) {
+			OpaqueHitRecord hit;
+			VisibleIShape::findIntersection(camera.getRay(x, y), objs, hit);
+			if (hit.t != FLT_MAX && hit.texture != nullptr) {
+				for (size_t i = 0; i < textures.size(); i++) {
+					if (hit.texture == textures[i]) {
+						lookups.push_back({ replacements[i], hit.u, hit.v });
+					}
+				}
+			}
+		}
+	}
+	return lookups;
+}
+
+double timeLookups(const vector<TexelLookup>& lookups, color& checksum) {
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < PASSES; pass++) {
+		for (const TexelLookup& L : lookups) {
+			checksum += L.texture->getPixelUV(L.u, L.v);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / PASSES;
+}
+
+int main(int argc, char* argv[]) {
+	const TexelLayout layouts[] = { TexelLayout::ROW_MAJOR, TexelLayout::TILED, TexelLayout::MORTON, TexelLayout::BC1 };
+	const char* layoutNames[] = { "row-major", "tiled", "morton", "bc1" };
+	const int NUM_LAYOUTS = 4;
+
+	vector<Image*> textures[NUM_LAYOUTS];
+	for (int i = 0; i < NUM_LAYOUTS; i++) {
+		textures[i].push_back(new Image("blackbuck.ppm", layouts[i]));
+		textures[i].push_back(new Image("snail.ppm", layouts[i]));
+		textures[i].push_back(new Image("usflag.ppm", layouts[i]));
+	}
+
+	vector<VisibleIShapePtr> objs;
+	objs.push_back(new VisibleIShape(new ICylinderY(dvec3(0, 0, 0), 3.0, 10.0), gold, textures[0][0]));
+	objs.push_back(new VisibleIShape(new ICylinderY(dvec3(10, 0, 0), 3.0, 5.0), gold, textures[0][2]));
+	objs.push_back(new VisibleIShape(new ISphere(dvec3(-6, 2, 2), 3.0), brass, textures[0][1]));
+	objs.push_back(new VisibleIShape(new IDisk(dvec3(-5, 0, 6), dvec3(0, 0, 1), 3), gold, textures[0][0]));
+
+	const int W = 2 * WINDOW_WIDTH;
+	const int H = 2 * WINDOW_HEIGHT;
+	dvec3 cameraPos(9, 9, 9);
+	PerspectiveCamera upright(cameraPos, ORIGIN3D, Y_AXIS, PI_2, W, H);
+	PerspectiveCamera rolled(cameraPos, ORIGIN3D, dvec3(1, 0, -1), PI_2, W, H);
+	PerspectiveCamera distant(4.0 * cameraPos, ORIGIN3D, dvec3(1, 0, -1), PI_2 / 2, W, H);
+	const RaytracingCamera* cameras[] = { &upright, &rolled, &distant };
+	const char* cameraNames[] = { "upright camera", "rolled camera", "distant rolled camera" };
+
+	for (int c = 0; c < 3; c++) {
+		cout << cameraNames[c] << endl;
+		double baseline = 0.0;
+		for (int i = 0; i < NUM_LAYOUTS; i++) {
+			vector<TexelLookup> lookups = recordLookups(objs, *cameras[c], textures[0], textures[i]);
+			color checksum;
+			double ms = timeLookups(lookups, checksum);
+			if (i == 0) {
+				baseline = ms;
+			}
+			cout << '\t' << layoutNames[i] << " (" << textures[i][0]->getTexelMemory() << " bytes): "
+				<< lookups.size() << " lookups, "
+				<< ms << " ms/frame, speedup " << baseline / ms
+				<< " (checksum " << checksum << ")" << endl;
+		}
+	}
+	return 0;
+}
@@ -98,6 +98,20 @@ dvec2 RaytracingCamera::getProjectionPlaneCoordinates(double x, double y) const
 	return s;
 }
 
+/**
+ * @fn	dvec2 RaytracingCamera::getPixelCoordinates(const dvec2& planeCoords) const
+ * @brief	Inverse of getProjectionPlaneCoordinates.
+ * @param	planeCoords	Projection plane coordinates.
+ * @return	Pixel coordinates. Integers are pixel centers.
+ */
+
+dvec2 RaytracingCamera::getPixelCoordinates(const dvec2& planeCoords) const {
+	dvec2 pixel;
+	pixel.x = map(planeCoords.x, left, right, 0, nx) - 0.5;
+	pixel.y = map(planeCoords.y, bottom, top, 0, ny) - 0.5;
+	return pixel;
+}
+
 /**
  * @fn	void PerspectiveCamera::setupViewingParameters(int W, int H)
  * @brief	Calculates the viewing parameters associated with this camera.
@@ -173,6 +187,39 @@ Ray PerspectiveCamera::getRay(double x, double y) const {
 	return Ray(cameraFrame.origin, rayDirection);
 }
 
+/**
+ * @fn	bool OrthographicCamera::getPixelCoords(const dvec3& pt, dvec2& pixel) const
+ * @brief	Finds where a point appears in the image. Inverse of getRay.
+ * @param 		  	pt   	The point.
+ * @param [out]	  	pixel	The (x, y) that getRay would need to hit pt.
+ * @return	True if pt is in front of the camera.
+ */
+
+bool OrthographicCamera::getPixelCoords(const dvec3& pt, dvec2& pixel) const {
+	dvec3 d = pt - cameraFrame.origin;
+	pixel = getPixelCoordinates(dvec2(glm::dot(d, cameraFrame.u), glm::dot(d, cameraFrame.v)));
+	return glm::dot(d, cameraFrame.w) < 0.0;
+}
+
+/**
+ * @fn	bool PerspectiveCamera::getPixelCoords(const dvec3& pt, dvec2& pixel) const
+ * @brief	Finds where a point appears in the image. Inverse of getRay.
+ * @param 		  	pt   	The point.
+ * @param [out]	  	pixel	The (x, y) that getRay would need to hit pt.
+ * @return	True if pt is in front of the camera.
+ */
+
+bool PerspectiveCamera::getPixelCoords(const dvec3& pt, dvec2& pixel) const {
+	dvec3 d = pt - cameraFrame.origin;
+	double z = -glm::dot(d, cameraFrame.w);
+	if (z <= 0.0) {
+		return false;
+	}
+	dvec2 uv(glm::dot(d, cameraFrame.u), glm::dot(d, cameraFrame.v));
+	pixel = getPixelCoordinates(uv * (distToPlane / z));
+	return true;
+}
+
 /**
 * @fn	ostream &operator << (ostream &os, const RaytracingCamera &camera)
 * @brief	Output stream for cameras.
@@ -20,6 +20,9 @@ struct RaytracingCamera {
 	RaytracingCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const = 0;
+	virtual bool getPixelCoords(const dvec3& pt, dvec2& pixel) const = 0;
+	virtual RaytracingCamera* clone() const = 0;
+	virtual ~RaytracingCamera() {}
 	Frame getFrame() const { return cameraFrame; }
 	int getNX() const { return nx; }
 	int getNY() const { return ny; }
@@ -35,6 +38,7 @@ protected:
 	void setupFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up);
 	virtual void setupViewingParameters(int width, int height) = 0;
 	dvec2 getProjectionPlaneCoordinates(double x, double y) const;
+	dvec2 getPixelCoordinates(const dvec2& planeCoords) const;
 public:
 	friend ostream& operator << (ostream& os, const RaytracingCamera& camera);
 };
@@ -48,6 +52,8 @@ struct PerspectiveCamera : public RaytracingCamera {
 	PerspectiveCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up, double FOVRads,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const;
+	virtual bool getPixelCoords(const dvec3& pt, dvec2& pixel) const;
+	virtual RaytracingCamera* clone() const { return new PerspectiveCamera(*this); }
 	double getDistToPlane() const { return distToPlane; }
 private:
 	double fov;						//!< The camera's field of view
@@ -64,6 +70,8 @@ struct OrthographicCamera : public RaytracingCamera {
 	OrthographicCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 		int width, int height, double scaleFactor = 1.0);
 	virtual Ray getRay(double x, double y) const;
+	virtual bool getPixelCoords(const dvec3& pt, dvec2& pixel) const;
+	virtual RaytracingCamera* clone() const { return new OrthographicCamera(*this); }
 private:
 	double scale;		//!< Controls the size of the image plane.
 	virtual void setupViewingParameters(int width, int height);
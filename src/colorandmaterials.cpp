@@ -100,6 +100,18 @@ Material Material::operator +(const Material& mat) const {
 	return result;
 }
 
+/**
+ * @fn	bool Material::operator==(const Material &mat) const
+ * @brief	Compares two Materials
+ * @param	mat	The second Material.
+ * @return	True if every property of the two Materials is the same.
+ */
+
+bool Material::operator ==(const Material& mat) const {
+	return ambient == mat.ambient && diffuse == mat.diffuse &&
+		specular == mat.specular && shininess == mat.shininess;
+}
+
 /**
  * @fn	Material operator*(double w, const Material &mat)
  * @brief	Multiply a Material and a scalar.
@@ -36,6 +36,8 @@ using std::ostream;
 using std::istream;
 using std::string;
 
+using glm::vec2;
+using glm::vec3;
 using glm::dvec2;
 using glm::ivec2;
 using glm::dvec3;
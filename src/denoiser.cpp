@@ -0,0 +1,147 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "denoiser.h"
+
+/**
+ * @fn	static double normalWeight(const dvec3& n1, const dvec3& n2)
+ * @brief	Falls off with the angle between two normals.
+ * @param	n1	The first normal.
+ * @param	n2	The second normal.
+ * @return	cos^DENOISE_NORMAL_POWER, clamped to 0 for opposing normals.
+ */
+
+static double normalWeight(const dvec3& n1, const dvec3& n2) {
+	double w = glm::max(glm::dot(n1, n2), 0.0);
+	for (int i = 1; i < DENOISE_NORMAL_POWER; i *= 2) {
+		w *= w;
+	}
+	return w;
+}
+
+/**
+ * @fn	void Denoiser::denoise(FrameBuffer& frameBuffer, const vector<GBufferSample>& aux,
+ *								int iterations, double varianceScale)
+ * @brief	Filters the colors in a framebuffer in place. The accumulation buffer,
+ * 			if any, is not changed, so the next resolve starts from the unfiltered
+ * 			colors again.
+ * @param [in,out]	frameBuffer  	Framebuffer.
+ * @param 		  	aux			 	Depth, normal, albedo and variance of each pixel,
+ * 									row-major, bottom row first.
+ * @param 		  	iterations   	Number of a-trous passes. 0 does nothing.
+ * @param 		  	varianceScale	Multiplies the variances, e.g. 1 / n for the
+ * 									average of n accumulated passes.
+ */
+
+void Denoiser::denoise(FrameBuffer& frameBuffer, const vector<GBufferSample>& aux,
+	int iterations, double varianceScale) {
+	static const double KERNEL[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+	static const double BLUR[3] = { 0.25, 0.5, 0.25 };
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	if (iterations <= 0 || (int)aux.size() != W * H) {
+		return;
+	}
+	vector<color> albedo(W * H);
+	vector<color> irradiance(W * H);
+	vector<color> filtered(W * H);
+	vector<double> variance(W * H);
+	vector<double> filteredVariance(W * H);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			int i = y * W + x;
+			albedo[i] = aux[i].depth == FLT_MAX ? white : glm::max(aux[i].albedo, color(0.01, 0.01, 0.01));
+			irradiance[i] = frameBuffer.getColor(x, y) / albedo[i];
+			double a = (albedo[i].r + albedo[i].g + albedo[i].b) / 3.0;
+			variance[i] = aux[i].variance * varianceScale / (a * a);
+		}
+	}
+
+	for (int it = 0; it < iterations; it++) {
+		const int step = 1 << it;
+		for (int y = 0; y < H; y++) {
+			for (int x = 0; x < W; x++) {
+				const int p = y * W + x;
+				const GBufferSample& center = aux[p];
+				const color& cp = irradiance[p];
+				const double depthScale = 1.0 / (DENOISE_DEPTH_SIGMA * center.depth * step);
+
+				// Per pixel estimates are noisy too, so blur them a little
+				double blurred = 0.0;
+				for (int j = -1; j <= 1; j++) {
+					for (int i = -1; i <= 1; i++) {
+						int xx = glm::clamp(x + i, 0, W - 1);
+						int yy = glm::clamp(y + j, 0, H - 1);
+						blurred += BLUR[i + 1] * BLUR[j + 1] * variance[yy * W + xx];
+					}
+				}
+				if (blurred < DENOISE_MIN_VARIANCE) {
+					filtered[p] = cp;
+					filteredVariance[p] = 0.0;
+					continue;
+				}
+				const double invSigma2 = 1.0 / (DENOISE_COLOR_SIGMA * DENOISE_COLOR_SIGMA * blurred);
+
+				color total_c;
+				double totalWeight = 0.0;
+				double totalVariance = 0.0;
+				for (int j = 0; j < 5; j++) {
+					int yy = y + (j - 2) * step;
+					if (yy < 0 || yy >= H) {
+						continue;
+					}
+					for (int i = 0; i < 5; i++) {
+						int xx = x + (i - 2) * step;
+						if (xx < 0 || xx >= W) {
+							continue;
+						}
+						const int q = yy * W + xx;
+						const GBufferSample& tap = aux[q];
+						double weight = KERNEL[i] * KERNEL[j];
+						if (center.depth == FLT_MAX || tap.depth == FLT_MAX) {
+							if (center.depth != tap.depth) {
+								continue;
+							}
+						} else {
+							weight *= normalWeight(center.normal, tap.normal);
+							if (weight == 0.0) {
+								continue;
+							}
+							double dz = std::abs(center.depth - tap.depth) * depthScale;
+							color dc = irradiance[q] - cp;
+							weight *= std::exp(-glm::dot(dc, dc) / 3.0 * invSigma2 - dz);
+						}
+						total_c += weight * irradiance[q];
+						totalWeight += weight;
+						totalVariance += weight * weight * variance[q];
+					}
+				}
+				filtered[p] = total_c / totalWeight;
+				filteredVariance[p] = totalVariance / (totalWeight * totalWeight);
+			}
+		}
+		irradiance.swap(filtered);
+		variance.swap(filteredVariance);
+	}
+
+	color colors[FB_TILE_AREA];
+	for (int y0 = 0; y0 < H; y0 += FB_TILE_SIZE) {
+		for (int x0 = 0; x0 < W; x0 += FB_TILE_SIZE) {
+			int w = glm::min(FB_TILE_SIZE, W - x0);
+			int h = glm::min(FB_TILE_SIZE, H - y0);
+			for (int j = 0; j < h; j++) {
+				for (int i = 0; i < w; i++) {
+					int p = (y0 + j) * W + x0 + i;
+					colors[j * w + i] = irradiance[p] * albedo[p];
+				}
+			}
+			frameBuffer.setColorTile(x0, y0, w, h, colors);
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "framebuffer.h"
+#include "renderhistory.h"
+
+const int DENOISE_ITERATIONS = 3;			//!< A-trous passes; the filter spans 2^(n+1) + 1 pixels.
+const double DENOISE_COLOR_SIGMA = 2.0;		//!< Color tolerance, in standard deviations of the noise.
+const double DENOISE_NORMAL_POWER = 32.0;	//!< Sharpness of the normal test.
+const double DENOISE_DEPTH_SIGMA = 0.01;	//!< Depth tolerance per pixel of distance, relative to depth.
+const double DENOISE_MIN_VARIANCE = 1.0E-8;	//!< Pixels with less estimated variance are not filtered.
+
+/**
+ * @struct	Denoiser
+ * @brief	Edge-aware filter for noisy ray traced frames, after "Edge-Avoiding
+ * 			A-Trous Wavelet Transform for fast Global Illumination Filtering"
+ * 			(Dammertz et al., 2010). Each pass blurs with a 5x5 B3 spline whose
+ * 			taps are twice as far apart as in the pass before. Taps that differ
+ * 			from the center in normal or depth get less weight, so edges stay
+ * 			sharp. So do taps that differ in color by more than the pixel's noise
+ * 			explains, as estimated by the ray tracer and propagated through the
+ * 			passes as in SVGF (Schied et al., 2017). Pixels without noise are
+ * 			left alone. Colors are divided by albedo first and multiplied back
+ * 			afterwards, so textures are not blurred with the noise.
+ */
+
+struct Denoiser {
+	static void denoise(FrameBuffer& frameBuffer, const vector<GBufferSample>& aux,
+		int iterations, double varianceScale = 1.0);
+};
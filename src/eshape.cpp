@@ -9,33 +9,114 @@
 
 #include "eshape.h"
 
+/**
+ * @fn	EVertex::EVertex(const dvec4& pos, const dvec3& normal, const dvec2& uv)
+ * @brief	Constructor
+ * @param	pos   	Position, in object coordinates.
+ * @param	normal	Normal vector.
+ * @param	uv	  	Texture coordinates.
+ */
+
+EVertex::EVertex(const dvec4& pos, const dvec3& normal, const dvec2& uv) :
+	pos(pos.xyz()), normal(glm::normalize(normal)), uv(uv) {
+}
+
+/**
+ * @fn	unsigned int EMeshData::addMaterial(const Material& mat)
+ * @brief	Adds a material to the mesh's table, unless it is already there.
+ * @param	mat	The material.
+ * @return	The material's index.
+ */
+
+unsigned int EMeshData::addMaterial(const Material& mat) {
+	for (unsigned int i = 0; i < materials.size(); i++) {
+		if (materials[i] == mat) {
+			return i;
+		}
+	}
+	materials.push_back(mat);
+	return (unsigned int)materials.size() - 1;
+}
+
+/**
+ * @fn	unsigned int EMeshData::addVertex(const EVertex& vertex)
+ * @brief	Adds a vertex to the mesh.
+ * @param	vertex	The vertex.
+ * @return	The vertex's index.
+ */
+
+unsigned int EMeshData::addVertex(const EVertex& vertex) {
+	vertices.push_back(vertex);
+	return (unsigned int)vertices.size() - 1;
+}
+
+/**
+ * @fn	void EMeshData::addTriangle(unsigned int i0, unsigned int i1, unsigned int i2,
+ *									unsigned int material)
+ * @brief	Adds a triangle made of vertices already in the mesh. Vertices are
+ * 			specified in counterclockwise order.
+ * @param	i0		 	Index of the first vertex.
+ * @param	i1		 	Index of the second vertex.
+ * @param	i2		 	Index of the third vertex.
+ * @param	material	Index of the triangle's material, from addMaterial.
+ */
+
+void EMeshData::addTriangle(unsigned int i0, unsigned int i1, unsigned int i2, unsigned int material) {
+	indices.push_back(i0);
+	indices.push_back(i1);
+	indices.push_back(i2);
+	triangleMaterials.push_back(material);
+}
+
+/**
+ * @fn	void EMeshData::addTriVertsAndComputeNormal(const dvec4& V1, const dvec4& V2,
+ *													const dvec4& V3, unsigned int material)
+ * @brief	Adds a flat shaded triangle with three vertices of its own, and
+ * 			computes its normal. Vertices are specified in counterclockwise order.
+ * @param	V1		 	The first vertex.
+ * @param	V2		 	The second vertex.
+ * @param	V3		 	The third vertex.
+ * @param	material	Index of the triangle's material, from addMaterial.
+ */
+
+void EMeshData::addTriVertsAndComputeNormal(const dvec4& V1, const dvec4& V2, const dvec4& V3,
+	unsigned int material) {
+	dvec3 n = normalFrom3Points(V1.xyz(), V2.xyz(), V3.xyz());
+	unsigned int first = addVertex(EVertex(V1, n));
+	addVertex(EVertex(V2, n));
+	addVertex(EVertex(V3, n));
+	addTriangle(first, first + 1, first + 2, material);
+}
+
  /**
-  * @fn	EShapeData EShape::createEDisk(const Material &mat, int slices)
+  * @fn	EMeshData EShape::createEDisk(const Material &mat, int slices)
   * @brief	Creates a disk with radius 1, centered on origin and lying at z = 0
   * @param	mat   	Material.
   * @param	slices	Number of slices.
   * @return	The new disk.
   */
 
-EShapeData EShape::createEDisk(const Material& mat, int slices) {
-	EShapeData result;
+EMeshData EShape::createEDisk(const Material& mat, int slices) {
+	EMeshData result;
+	unsigned int material = result.addMaterial(mat);
 
 	double angleInc = TWO_PI / slices;
 
+	// The center and the points on the rim are each shared by the slices that meet there.
+	unsigned int center = result.addVertex(EVertex(dvec4(0.0, 0.0, 0.0, 1.0), Z_AXIS));
 	for (int i = 0; i < slices; i++) {
 		double A1 = i * angleInc;
-		double A2 = A1 + angleInc;
-		dvec4 A(0.0, 0.0, 0.0, 1.0);
-		dvec4 B(std::cos(A1), std::sin(A1), 0.0, 1.0);
-		dvec4 C(std::cos(A2), std::sin(A2), 0.0, 1.0);
-		VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+		result.addVertex(EVertex(dvec4(std::cos(A1), std::sin(A1), 0.0, 1.0), Z_AXIS));
+	}
+	for (int i = 0; i < slices; i++) {
+		result.addTriangle(center, center + 1 + i, center + 1 + (i + 1) % slices, material);
 	}
 
 	return result;
 }
 
 /**
- * @fn	EShapeData EShape::createECylinder(const Material &mat, int slices)
+ * @fn	EMeshData EShape::createECylinder(const Material &mat, int slices)
  * @brief	Creates cylinder, which is centered on (0,0,0) and aligned with y axis and with
  *			height = 1 and radius = 1
  * @param	mat   	Material.
@@ -43,31 +124,31 @@ EShapeData EShape::createEDisk(const Material& mat, int slices) {
  * @return	The new cylinder.
  */
  
-EShapeData EShape::createECylinder(const Material& mat, int slices) {
-	EShapeData result;
+EMeshData EShape::createECylinder(const Material& mat, int slices) {
+	EMeshData result;
 	dvec4 A(0, 0, 0, 1);
 	dvec4 B(1, 1, 1, 1);
 	dvec4 C(0, 1, 0, 1);
-	VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+	result.addTriVertsAndComputeNormal(A, B, C, result.addMaterial(mat));
 	return result;
 }
 
 /**
- * @fn	EShapeData EShape::createECone(const Material &mat, int slices)
+ * @fn	EMeshData EShape::createECone(const Material &mat, int slices)
  * @brief	Creates cone, which is aligned with y axis. Height and radius = 1
  * @param	mat   	Material.
  * @param	slices	Slices.
  * @return	The new cone.
  */
 
-EShapeData EShape::createECone(const Material& mat, int slices) {
+EMeshData EShape::createECone(const Material& mat, int slices) {
 	/* CSE 386 - todo  */
-	EShapeData result;
+	EMeshData result;
 	return result;
 }
 
 /**
- * @fn	EShapeData EShape::createETriangle(const Material &mat,
+ * @fn	EMeshData EShape::createETriangle(const Material &mat,
  *											const dvec4& A, const dvec4& B, const dvec4& C)
  * @brief	Creates one triangles from 3 vertices
  * @param	mat	Material.
@@ -77,15 +158,15 @@ EShapeData EShape::createECone(const Material& mat, int slices) {
  * @return	The new triangles.
  */
 
-EShapeData EShape::createETriangle(const Material& mat,
+EMeshData EShape::createETriangle(const Material& mat,
 	const dvec4& A, const dvec4& B, const dvec4& C) {
-	EShapeData result;
-	VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+	EMeshData result;
+	result.addTriVertsAndComputeNormal(A, B, C, result.addMaterial(mat));
 	return result;
 }
 
 /**
- * @fn	EShapeData EShape::createECheckerBoard(const Material &mat1, const Material &mat2, double WIDTH, double HEIGHT, int DIV)
+ * @fn	EMeshData EShape::createECheckerBoard(const Material &mat1, const Material &mat2, double WIDTH, double HEIGHT, int DIV)
  * @brief	Creates checker board pattern.
  * @param	mat1  	Material #1.
  * @param	mat2  	Material #2.
@@ -95,27 +176,31 @@ EShapeData EShape::createETriangle(const Material& mat,
  * @return	The vertices in the checker board.
  */
 
-EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat2,
+EMeshData EShape::createECheckerBoard(const Material& mat1, const Material& mat2,
 	double WIDTH, double HEIGHT, int DIV) {
-	EShapeData result;
+	EMeshData result;
+	const unsigned int material1 = result.addMaterial(mat1);
+	const unsigned int material2 = result.addMaterial(mat2);
 
 	const double INC = WIDTH / DIV;
+
+	// Materials belong to the squares, not to their corners, so every corner
+	// of the grid is shared by the squares that meet there.
+	for (int X = 0; X <= DIV; X++) {
+		for (int Z = 0; Z <= DIV; Z++) {
+			result.addVertex(EVertex(dvec4(-WIDTH / 2.0 + X * INC, 0.0, -WIDTH / 2 + Z * INC, 1.0), Y_AXIS));
+		}
+	}
 	for (int X = 0; X < DIV; X++) {
 		bool isMat1 = X % 2 == 0;
-		for (double Z = 0; Z < DIV; Z++) {
-			dvec4 V0(-WIDTH / 2.0 + X * INC, 0.0, -WIDTH / 2 + Z * INC, 1.0);
-			dvec4 V1 = V0 + dvec4(0.0, 0.0, INC, 0.0);
-			dvec4 V2 = V0 + dvec4(INC, 0.0, INC, 0.0);
-			dvec4 V3 = V0 + dvec4(INC, 0.0, 0.0, 0.0);
-			const Material& mat = isMat1 ? mat1 : mat2;
-
-			result.push_back(VertexData(V0, Y_AXIS, mat));
-			result.push_back(VertexData(V1, Y_AXIS, mat));
-			result.push_back(VertexData(V2, Y_AXIS, mat));
-
-			result.push_back(VertexData(V2, Y_AXIS, mat));
-			result.push_back(VertexData(V3, Y_AXIS, mat));
-			result.push_back(VertexData(V0, Y_AXIS, mat));
+		for (int Z = 0; Z < DIV; Z++) {
+			unsigned int i0 = X * (DIV + 1) + Z;
+			unsigned int i1 = i0 + 1;
+			unsigned int i2 = i1 + DIV + 1;
+			unsigned int i3 = i0 + DIV + 1;
+			const unsigned int material = isMat1 ? material1 : material2;
+			result.addTriangle(i0, i1, i2, material);
+			result.addTriangle(i2, i3, i0, material);
 			isMat1 = !isMat1;
 		}
 	}
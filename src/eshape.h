@@ -16,19 +16,54 @@
 
 typedef vector<VertexData> EShapeData;
 
+/**
+ * @struct	EVertex
+ * @brief	A vertex of a mesh, as it is stored: single precision, with no
+ * 			material. The pipeline widens it to a VertexData when it is drawn.
+ */
+
+struct EVertex {
+	vec3 pos;		//!< Position, in object coordinates
+	vec3 normal;	//!< Normal vector
+	vec2 uv;		//!< Texture coordinates, if the mesh has any
+
+	EVertex(const dvec4& pos, const dvec3& normal, const dvec2& uv = dvec2(0.0));
+};
+
+/**
+ * @struct	EMeshData
+ * @brief	An indexed mesh. Each vertex is stored once, and each successive
+ * 			triplet of indices is a triangle, so a vertex shared by several
+ * 			triangles is only transformed once. Materials are kept in a table,
+ * 			and each triangle has the index of its own.
+ */
+
+struct EMeshData {
+	vector<EVertex> vertices;				//!< The mesh's vertices
+	vector<unsigned int> indices;			//!< Indices into vertices, three per triangle
+	vector<Material> materials;				//!< The mesh's material table
+	vector<unsigned int> triangleMaterials;	//!< Index into materials, one per triangle
+
+	unsigned int addMaterial(const Material& mat);
+	unsigned int addVertex(const EVertex& vertex);
+	void addTriangle(unsigned int i0, unsigned int i1, unsigned int i2, unsigned int material);
+	void addTriVertsAndComputeNormal(const dvec4& V1, const dvec4& V2, const dvec4& V3,
+		unsigned int material);
+	int numTriangles() const { return (int)indices.size() / 3; }
+};
+
 /**
  * @struct	EShape
  * @brief	This class contains functions that create explicitly represented shapes.
  * 			This class is used within pipeline applications. The objects returned by
- * 			these routines are vectors of VertexData, where each successive triplet
- * 			is a triangle.
+ * 			these routines are indexed meshes.
  */
 
 struct EShape {
-	static EShapeData createETriangle(const Material& mat,
+	static EMeshData createETriangle(const Material& mat,
 		const dvec4& A, const dvec4& B, const dvec4& C);
-	static EShapeData createEDisk(const Material& mat, int slices = DEFAULT_SLICES);
-	static EShapeData createECylinder(const Material& mat, int slices = DEFAULT_SLICES);
-	static EShapeData createECone(const Material& mat, int slices = DEFAULT_SLICES);
-	static EShapeData createECheckerBoard(const Material& mat1, const Material& mat2, double WIDTH, double HEIGHT, int DIV);
+	static EMeshData createEDisk(const Material& mat, int slices = DEFAULT_SLICES);
+	static EMeshData createECylinder(const Material& mat, int slices = DEFAULT_SLICES);
+	static EMeshData createECone(const Material& mat, int slices = DEFAULT_SLICES);
+	static EMeshData createECheckerBoard(const Material& mat1, const Material& mat2, double WIDTH, double HEIGHT, int DIV);
 };
@@ -41,6 +41,7 @@ void render() {
 
 	scene.camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, PI/2, width, height);
 	rayTrace.raytraceScene(frameBuffer, 0, scene);
+	frameBuffer.showColorBuffer();
 
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
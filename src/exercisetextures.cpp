@@ -66,6 +66,7 @@ void render() {
 
 	frameBuffer.clearColorBuffer();
 	rayTrace.raytraceScene(frameBuffer, 0, theScene);
+	frameBuffer.showColorBuffer();
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME);
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 
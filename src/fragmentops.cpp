@@ -47,7 +47,7 @@ color FragmentOps::applyLighting(const Fragment& fragment, const dvec3& eyePosit
 	const vector<LightSourcePtr>& lights,
 	const Frame& eyeFrame) {
 	/* CSE 386 - todo  */
-	return fragment.material.diffuse;
+	return fragment.material->diffuse;
 }
 
 /**
@@ -104,8 +104,184 @@ void FragmentOps::processFragment(FrameBuffer& frameBuffer, const dvec3& eyePosi
 	int Y = (int)fragment.windowPos.y;
 	DEBUG_PIXEL = (X == xDebug && Y == yDebug);
 
+	// The depth test comes first, so hidden fragments are never shaded.
+	if (performDepthTest && Z >= frameBuffer.getDepth(X, Y)) {
+		return;
+	}
+	if (frameBuffer.isDeferred()) {
+		if (!readonlyColorBuffer) {
+			frameBuffer.setGBufferSpan(X, Y, 1, &fragment.worldNormal, &fragment.worldPos, &fragment.materialId);
+		}
+		if (!readonlyDepthBuffer) {
+			frameBuffer.setDepth(X, Y, Z);
+		}
+		return;
+	}
+
 	/* CSE 386 - todo */
-	color C = fragment.material.diffuse;
-	frameBuffer.setColor(X, Y, C);
-	frameBuffer.setDepth(X, Y, Z);
-}
\ No newline at end of file
+	color C = applyLighting(fragment, eyePos, lights, eyeFrame);
+	C = applyFog(C, eyePos, fragment.worldPos);
+	if (!readonlyColorBuffer) {
+		frameBuffer.setColor(X, Y, C);
+	}
+	if (!readonlyDepthBuffer) {
+		frameBuffer.setDepth(X, Y, Z);
+	}
+}
+/**
+ * @fn	void FragmentRun::clear()
+ * @brief	Empties the run.
+ */
+
+void FragmentRun::clear() {
+	depths.clear();
+	colors.clear();
+	normals.clear();
+	worldPositions.clear();
+	materialIds.clear();
+}
+
+/**
+ * @fn	void FragmentOps::writeRun(FrameBuffer& frameBuffer, FragmentRun& run)
+ * @brief	Writes a run of fragments to the framebuffer, or to its G-buffer
+ * 			when shading is deferred, honoring readonlyColorBuffer and
+ * 			readonlyDepthBuffer, and empties the run.
+ * @param [in,out]	frameBuffer	The frame buffer
+ * @param [in,out]	run		   	The run.
+ */
+
+void FragmentOps::writeRun(FrameBuffer& frameBuffer, FragmentRun& run) {
+	const int N = (int)run.depths.size();
+	if (N == 0) {
+		return;
+	}
+	if (frameBuffer.isDeferred()) {
+		if (!readonlyColorBuffer) {
+			frameBuffer.setGBufferSpan(run.x, run.y, N, run.normals.data(),
+				run.worldPositions.data(), run.materialIds.data());
+		}
+		if (!readonlyDepthBuffer) {
+			frameBuffer.setDepthSpan(run.x, run.y, N, run.depths.data());
+		}
+	} else if (!readonlyColorBuffer && !readonlyDepthBuffer) {
+		frameBuffer.setPixelSpan(run.x, run.y, N, run.colors.data(), run.depths.data());
+	} else if (!readonlyColorBuffer) {
+		frameBuffer.setColorSpan(run.x, run.y, N, run.colors.data());
+	} else if (!readonlyDepthBuffer) {
+		frameBuffer.setDepthSpan(run.x, run.y, N, run.depths.data());
+	}
+	run.clear();
+}
+
+/**
+ * @fn	void FragmentOps::processFragmentSpan(FrameBuffer &frameBuffer,
+ *											const dvec3 &eyePositionInWorldCoords,
+ *											const vector<LightSourcePtr> &lights,
+ *											const vector<Fragment> &fragments,
+ *											const Frame &eyeFrame)
+ * @brief	Process a run of fragments that cover consecutive pixels of one row,
+ * 			left to right. Fragments that fail the depth test are dropped before
+ * 			they are shaded; if the whole span is nearer than the nearest depth
+ * 			of the tiles under it, the per-pixel depths are not read at all. The
+ * 			runs of fragments that pass are written to the framebuffer as spans.
+ * 			When shading is deferred, they are written to the G-buffer unlit.
+ * @param [in,out]	frameBuffer	                The frame buffer
+ * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
+ * @param 		  	lights						Vector of lights in scene.
+ * @param 		  	fragments					Fragments to be processed.
+ * @param           eyeFrame                    The camera's frame.
+ */
+
+void FragmentOps::processFragmentSpan(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+	const vector<LightSourcePtr>& lights,
+	const vector<Fragment>& fragments,
+	const Frame& eyeFrame) {
+	if (fragments.empty()) {
+		return;
+	}
+	const dvec3& eyePos = eyePositionInWorldCoords;
+	const int N = (int)fragments.size();
+	const int X = (int)fragments[0].windowPos.x;
+	const int Y = (int)fragments[0].windowPos.y;
+	const bool deferred = frameBuffer.isDeferred();
+
+	bool testEach = performDepthTest;
+	if (testEach) {
+		double nearest = fragments[0].windowPos.z;
+		double farthest = fragments[0].windowPos.z;
+		for (int i = 1; i < N; i++) {
+			nearest = glm::min(nearest, fragments[i].windowPos.z);
+			farthest = glm::max(farthest, fragments[i].windowPos.z);
+		}
+		double minDepth, maxDepth;
+		frameBuffer.getDepthBounds(X, Y, X + N - 1, Y, minDepth, maxDepth);
+		if (nearest >= maxDepth) {
+			return;
+		}
+		testEach = farthest >= minDepth;
+	}
+
+	static thread_local FragmentRun run;	// Reused, so spans do not allocate
+	run.clear();
+	run.x = X;
+	run.y = Y;
+	for (int i = 0; i < N; i++) {
+		const Fragment& fragment = fragments[i];
+		DEBUG_PIXEL = (X + i == xDebug && Y == yDebug);
+		if (testEach && fragment.windowPos.z >= frameBuffer.getDepth(X + i, Y)) {
+			writeRun(frameBuffer, run);
+			run.x = X + i + 1;
+			continue;
+		}
+		run.depths.push_back(fragment.windowPos.z);
+		if (deferred) {
+			run.normals.push_back(fragment.worldNormal);
+			run.worldPositions.push_back(fragment.worldPos);
+			run.materialIds.push_back(fragment.materialId);
+			continue;
+		}
+
+		/* CSE 386 - todo */
+		color C = applyLighting(fragment, eyePos, lights, eyeFrame);
+		run.colors.push_back(applyFog(C, eyePos, fragment.worldPos));
+	}
+	writeRun(frameBuffer, run);
+}
+
+/**
+ * @fn	void FragmentOps::shadeDeferred(FrameBuffer &frameBuffer,
+ *										const dvec3 &eyePositionInWorldCoords,
+ *										const vector<LightSourcePtr> &lights,
+ *										const Frame &eyeFrame)
+ * @brief	The lighting pass of deferred shading. Call it once everything has
+ * 			been drawn. Each pixel the G-buffer covers is lit and fogged once,
+ * 			however many fragments were drawn over it, and tiles are lit in
+ * 			parallel.
+ * @param [in,out]	frameBuffer	                The frame buffer
+ * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
+ * @param 		  	lights						Vector of lights in scene.
+ * @param           eyeFrame                    The camera's frame.
+ */
+
+void FragmentOps::shadeDeferred(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+	const vector<LightSourcePtr>& lights,
+	const Frame& eyeFrame) {
+	if (readonlyColorBuffer) {
+		return;
+	}
+	const dvec3& eyePos = eyePositionInWorldCoords;
+	frameBuffer.shadeGBuffer([&](GBufferTile& tile) {
+		for (int n = 0; n < tile.count; n++) {
+			Fragment fragment;
+			fragment.windowPos = dvec3(tile.x[n], tile.y[n], tile.depth[n]);
+			fragment.material = tile.material[n];
+			fragment.worldNormal = dvec3(tile.normal[0][n], tile.normal[1][n], tile.normal[2][n]);
+			fragment.worldPos = dvec3(tile.worldPos[0][n], tile.worldPos[1][n], tile.worldPos[2][n]);
+			DEBUG_PIXEL = (tile.x[n] == xDebug && tile.y[n] == yDebug);
+
+			/* CSE 386 - todo */
+			color C = applyLighting(fragment, eyePos, lights, eyeFrame);
+			tile.colors[n] = applyFog(C, eyePos, fragment.worldPos);
+		}
+	});
+}
@@ -44,11 +44,28 @@ struct FogParams {
 
 struct Fragment {
 	dvec3 windowPos;	//!< (x, y) is window coordinate. z is depth.
-	Material material;	//!< Material to use
+	const Material* material;	//!< Material of the fragment's triangle
+	int materialId;		//!< Palette index of the material, when shading deferred
 	dvec3 worldNormal;	//!< Transformed normal vector from early in pipeline
 	dvec3 worldPos;		//!< Saved position from early in the pipeline
 };
 
+/**
+ * @struct	FragmentRun
+ * @brief	Fragments that passed the depth test, covering consecutive pixels of
+ * 			a row, waiting to be written to the framebuffer.
+ */
+
+struct FragmentRun {
+	int x, y;						//!< The first pixel
+	vector<double> depths;			//!< Depths
+	vector<color> colors;			//!< Lit colors, when shading forward
+	vector<dvec3> normals;			//!< World normals, when shading deferred
+	vector<dvec3> worldPositions;	//!< World positions, when shading deferred
+	vector<int> materialIds;		//!< Material palette indices, when shading deferred
+	void clear();
+};
+
 /**
  * @class	FragmentOps
  * @brief	Class to encapsulate the methods related to fragment processing.
@@ -64,6 +81,13 @@ public:
 		const vector<LightSourcePtr> lights,
 		const Fragment& fragment,
 		const Frame& eyeFrame);
+	static void processFragmentSpan(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+		const vector<LightSourcePtr>& lights,
+		const vector<Fragment>& fragments,
+		const Frame& eyeFrame);
+	static void shadeDeferred(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
+		const vector<LightSourcePtr>& lights,
+		const Frame& eyeFrame);
 protected:
 	static color applyFog(const color& destColor,
 		const dvec3& eyePos, const dvec3& fragPos);
@@ -72,4 +96,5 @@ protected:
 		const dvec3& eyePositionInWorldCoords,
 		const vector<LightSourcePtr>& lights,
 		const Frame& eyeFrame);
+	static void writeRun(FrameBuffer& frameBuffer, FragmentRun& run);
 };
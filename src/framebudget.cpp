@@ -0,0 +1,148 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "framebudget.h"
+
+const double COST_SMOOTHING = 0.3;	//!< Weight of the newest frame in secondsPerUnit.
+
+/**
+ * @fn	double QualitySettings::relativeCost(int width, int height, int numLights) const
+ * @brief	Estimates the work of a frame. Every ray recurses numReflections
+ * 			times, and at each level casts shadowSamples feelers per light.
+ * 			At reduced resolution, every pixel also casts one unshaded ray
+ * 			to guide the upsample.
+ * @param	width	 	Width of the framebuffer.
+ * @param	height   	Height of the framebuffer.
+ * @param	numLights	Number of lights in the scene.
+ * @return	The estimated work, in rays.
+ */
+
+double QualitySettings::relativeCost(int width, int height, int numLights) const {
+	double primaryRays = (double)width * height * antiAliasing * antiAliasing /
+		(resolutionDivisor * resolutionDivisor);
+	double guideRays = resolutionDivisor > 1 ? (double)width * height : 0.0;
+	return primaryRays * (numReflections + 1) * (1.0 + numLights * shadowSamples) + guideRays;
+}
+
+/**
+ * @fn	bool QualitySettings::operator == (const QualitySettings& other) const
+ * @brief	Equality operator.
+ * @param	other	The other settings.
+ * @return	True if all settings are the same.
+ */
+
+bool QualitySettings::operator == (const QualitySettings& other) const {
+	return resolutionDivisor == other.resolutionDivisor &&
+		antiAliasing == other.antiAliasing &&
+		numReflections == other.numReflections &&
+		shadowSamples == other.shadowSamples;
+}
+
+/**
+ * @fn	ostream& operator << (ostream& os, const QualitySettings& settings)
+ * @brief	Output stream for quality settings.
+ * @param	os			Output stream.
+ * @param	settings	The settings.
+ * @return	The output stream.
+ */
+
+ostream& operator << (ostream& os, const QualitySettings& settings) {
+	os << "1/" << settings.resolutionDivisor << " res, AA " << settings.antiAliasing
+		<< ", reflections " << settings.numReflections
+		<< ", shadow samples " << settings.shadowSamples;
+	return os;
+}
+
+/**
+ * @fn	FrameBudget::FrameBudget(double targetSeconds)
+ * @brief	Constructor.
+ * @param	targetSeconds	The target frame time.
+ */
+
+FrameBudget::FrameBudget(double targetSeconds)
+	: targetSeconds(targetSeconds), secondsPerUnit(0.0) {
+}
+
+/**
+ * @fn	double FrameBudget::predictSeconds(const QualitySettings& settings, int width, int height, int numLights) const
+ * @brief	Predicts how long a frame will take.
+ * @param	settings 	The settings.
+ * @param	width	 	Width of the framebuffer.
+ * @param	height   	Height of the framebuffer.
+ * @param	numLights	Number of lights in the scene.
+ * @return	Predicted seconds, or 0 if no frame has been measured.
+ */
+
+double FrameBudget::predictSeconds(const QualitySettings& settings, int width, int height, int numLights) const {
+	return secondsPerUnit * settings.relativeCost(width, height, numLights);
+}
+
+/**
+ * @fn	QualitySettings FrameBudget::chooseSettings(const QualitySettings& fullQuality,
+ *							bool sceneIsChanging, int width, int height, int numLights) const
+ * @brief	Chooses the settings for the next frame. While the scene is changing,
+ * 			quality is lowered until the frame is predicted to fit the budget:
+ * 			first anti-aliasing, then soft shadows, then reflections, then
+ * 			resolution, and finally shadows altogether. Before any frame has
+ * 			been measured, the cheapest settings are used. Once the scene stops
+ * 			changing, full quality is used so the image refines.
+ * @param	fullQuality	   	The settings the user asked for.
+ * @param	sceneIsChanging	True if the camera, lights or objects are moving.
+ * @param	width		   	Width of the framebuffer.
+ * @param	height		   	Height of the framebuffer.
+ * @param	numLights	   	Number of lights in the scene.
+ * @return	The settings to render with.
+ */
+
+QualitySettings FrameBudget::chooseSettings(const QualitySettings& fullQuality, bool sceneIsChanging,
+	int width, int height, int numLights) const {
+	QualitySettings S = fullQuality;
+	if (!sceneIsChanging) {
+		return S;
+	}
+	const bool measured = secondsPerUnit > 0.0;
+	while (!measured || predictSeconds(S, width, height, numLights) > targetSeconds) {
+		if (S.antiAliasing > 1) {
+			S.antiAliasing--;
+		} else if (S.shadowSamples > 1) {
+			S.shadowSamples = 1;
+		} else if (S.numReflections > 0) {
+			S.numReflections--;
+		} else if (S.resolutionDivisor < MAX_RESOLUTION_DIVISOR) {
+			S.resolutionDivisor *= 2;
+		} else if (S.shadowSamples > 0) {
+			S.shadowSamples = 0;
+		} else {
+			break;
+		}
+	}
+	return S;
+}
+
+/**
+ * @fn	void FrameBudget::recordFrame(const QualitySettings& settings, int width, int height,
+ *										int numLights, double seconds)
+ * @brief	Updates the cost model with the time of a finished frame.
+ * @param	settings 	The settings the frame was rendered with.
+ * @param	width	 	Width of the framebuffer.
+ * @param	height   	Height of the framebuffer.
+ * @param	numLights	Number of lights in the scene.
+ * @param	seconds  	How long the frame took.
+ */
+
+void FrameBudget::recordFrame(const QualitySettings& settings, int width, int height,
+	int numLights, double seconds) {
+	double units = settings.relativeCost(width, height, numLights);
+	if (units <= 0.0) {
+		return;
+	}
+	double measured = seconds / units;
+	secondsPerUnit = secondsPerUnit == 0.0 ? measured :
+		COST_SMOOTHING * measured + (1.0 - COST_SMOOTHING) * secondsPerUnit;
+}
@@ -0,0 +1,50 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include "defs.h"
+
+const int MAX_RESOLUTION_DIVISOR = 8;	//!< Coarsest resolution is 1/8 in each direction.
+
+/**
+ * @struct	QualitySettings
+ * @brief	The ray tracing settings that trade image quality for frame time.
+ */
+
+struct QualitySettings {
+	int resolutionDivisor;	//!< 1, 2, 4 or 8. One ray per divisor x divisor block.
+	int antiAliasing;		//!< Samples per pixel along each axis.
+	int numReflections;		//!< Recursion depth.
+	int shadowSamples;		//!< Shadow feelers per light. 0 disables shadows.
+	double relativeCost(int width, int height, int numLights) const;
+	bool operator == (const QualitySettings& other) const;
+	bool operator != (const QualitySettings& other) const { return !(*this == other); }
+};
+
+ostream& operator << (ostream& os, const QualitySettings& settings);
+
+/**
+ * @struct	FrameBudget
+ * @brief	Picks quality settings that are predicted to render within a target
+ * 			frame time. The prediction is the relative cost of the settings
+ * 			times the measured seconds per unit of cost, averaged over recent
+ * 			frames.
+ */
+
+struct FrameBudget {
+	double targetSeconds;		//!< Frame time to stay within.
+	FrameBudget(double targetSeconds);
+	QualitySettings chooseSettings(const QualitySettings& fullQuality, bool sceneIsChanging,
+		int width, int height, int numLights) const;
+	void recordFrame(const QualitySettings& settings, int width, int height,
+		int numLights, double seconds);
+	double predictSeconds(const QualitySettings& settings, int width, int height, int numLights) const;
+protected:
+	double secondsPerUnit;		//!< Smoothed cost of one unit of relativeCost. 0 until measured.
+};
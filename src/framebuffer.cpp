@@ -10,6 +10,13 @@
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
+#include "io.h"
+#include "threadpool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define FRAMEBUFFER_SSE2
+#endif
 
  /**
   * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
@@ -18,8 +25,12 @@
   * @param	height	The height.
   */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), depthBuffer(nullptr), exportBuffer(nullptr),
+	accumBuffer(nullptr), accumulatedPasses(0), gBuffer(nullptr), gMaterialIds(nullptr) {
+	setClearColor(black);
 	setFrameBufferSize(width, height);
+	setResolveParameters(1.0, 1.0, false);
 }
 
 /**
@@ -30,11 +41,16 @@ FrameBuffer::FrameBuffer(const int width, const int height) {
 FrameBuffer::~FrameBuffer() {
 	delete[] colorBuffer;
 	delete[] depthBuffer;
+	delete[] exportBuffer;
+	delete[] accumBuffer;
+	delete[] gBuffer;
+	delete[] gMaterialIds;
 }
 
 /**
  * @fn	void FrameBuffer::setFrameBufferSize(int width, int height)
- * @brief	Sets frame buffer size
+ * @brief	Sets frame buffer size. The buffers are padded to whole tiles, and
+ * 			start out cleared.
  * @param	width 	The width.
  * @param	height	The height.
  * @see https://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
@@ -43,11 +59,30 @@ FrameBuffer::~FrameBuffer() {
 void FrameBuffer::setFrameBufferSize(int width, int height) {
 	this->width = width;
 	this->height = height;
-	int area = width * height;
+	tilesAcross = (width + FB_TILE_SIZE - 1) / FB_TILE_SIZE;
+	tilesDown = (height + FB_TILE_SIZE - 1) / FB_TILE_SIZE;
+	int area = getPaddedArea();
 	delete[] colorBuffer;
 	delete[] depthBuffer;
+	delete[] exportBuffer;
 	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
-	depthBuffer = new double[area];
+	depthBuffer = new float[area];
+	exportBuffer = new GLubyte[width * height * BYTES_PER_PIXEL];
+	colorTileCleared.resize(tilesAcross * tilesDown);
+	depthTileCleared.resize(tilesAcross * tilesDown);
+	tileMinDepth.resize(tilesAcross * tilesDown);
+	tileMaxDepth.resize(tilesAcross * tilesDown);
+	depthBoundsStale.resize(tilesAcross * tilesDown);
+	clearColorAndDepthBuffers();
+	if (accumBuffer != nullptr) {
+		delete[] accumBuffer;
+		accumBuffer = new float[area * ACCUM_CHANNELS];
+		clearAccumBuffer();
+	}
+	if (gBuffer != nullptr) {
+		setDeferred(false);
+		setDeferred(true);
+	}
 }
 
 /**
@@ -76,28 +111,109 @@ void FrameBuffer::clearColorAndDepthBuffers() {
 
 /**
  * @fn	void FrameBuffer::clearColorBuffer()
- * @brief	Clears the color buffer
+ * @brief	Clears the color buffer. Only the tiles' flags are touched; the
+ * 			current clear color is remembered for when they are written.
  */
 
 void FrameBuffer::clearColorBuffer() {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-				clearColorUB, BYTES_PER_PIXEL);
-		}
+	for (int i = 0; i < CLEAR_PATTERN_PIXELS; i++) {
+		std::memcpy(clearPattern + BYTES_PER_PIXEL * i, clearColorUB, BYTES_PER_PIXEL);
 	}
+	std::fill(colorTileCleared.begin(), colorTileCleared.end(), 1);
 }
 
 /**
  * @fn	void FrameBuffer::clearDepthBuffer()
- * @brief	Clears the depth buffer
+ * @brief	Clears the depth buffer to 1.0, by flagging every tile as cleared.
+ * 			This empties the G-buffer too.
  */
 
 void FrameBuffer::clearDepthBuffer() {
-	int area = width * height;
-	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+	std::fill(depthTileCleared.begin(), depthTileCleared.end(), 1);
+	gMaterials.clear();
+	gMaterialIndex.clear();
 }
+
+/**
+ * @fn	void FrameBuffer::materializeColorTile(int tile)
+ * @brief	Fills a cleared color tile with the clear color, so it can be written.
+ * @param	tile	Index of the tile.
+ */
+
+void FrameBuffer::materializeColorTile(int tile) {
+	GLubyte* dst = colorBuffer + tile * FB_TILE_AREA * BYTES_PER_PIXEL;
+	const int PATTERN_BYTES = CLEAR_PATTERN_PIXELS * BYTES_PER_PIXEL;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128i a = _mm_loadu_si128((const __m128i*)clearPattern);
+	const __m128i b = _mm_loadu_si128((const __m128i*)(clearPattern + 16));
+	const __m128i c = _mm_loadu_si128((const __m128i*)(clearPattern + 32));
+	for (int i = 0; i < FB_TILE_AREA * BYTES_PER_PIXEL; i += PATTERN_BYTES) {
+		_mm_storeu_si128((__m128i*)(dst + i), a);
+		_mm_storeu_si128((__m128i*)(dst + i + 16), b);
+		_mm_storeu_si128((__m128i*)(dst + i + 32), c);
+	}
+#else
+	for (int i = 0; i < FB_TILE_AREA * BYTES_PER_PIXEL; i += PATTERN_BYTES) {
+		std::memcpy(dst + i, clearPattern, PATTERN_BYTES);
+	}
+#endif
+	colorTileCleared[tile] = 0;
+}
+
+/**
+ * @fn	void FrameBuffer::materializeDepthTile(int tile)
+ * @brief	Fills a cleared depth tile with 1.0, so it can be written.
+ * @param	tile	Index of the tile.
+ */
+
+void FrameBuffer::materializeDepthTile(int tile) {
+	float* dst = depthBuffer + tile * FB_TILE_AREA;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (int i = 0; i < FB_TILE_AREA; i += 4) {
+		_mm_storeu_ps(dst + i, one);
+	}
+#else
+	std::fill(dst, dst + FB_TILE_AREA, 1.0f);
+#endif
+	depthTileCleared[tile] = 0;
+	depthBoundsStale[tile] = 1;
+	if (gMaterialIds != nullptr) {
+		std::fill(gMaterialIds + tile * FB_TILE_AREA, gMaterialIds + (tile + 1) * FB_TILE_AREA, -1);
+	}
+}
+
+/**
+ * @fn	const GLubyte* FrameBuffer::getRowMajorColorBuffer() const
+ * @brief	Copies the tiled colors into a row-major array, bottom row first, as
+ * 			glDrawPixels expects. Every call rewrites the same array, so it is
+ * 			not reentrant. It must not run while another thread is calling it
+ * 			or drawing into this framebuffer, and the result of an earlier call
+ * 			is overwritten.
+ * @return	The row-major colors, valid until the next call or resize.
+ */
+
+const GLubyte* FrameBuffer::getRowMajorColorBuffer() const {
+	const int TILE_ROW_BYTES = FB_TILE_SIZE * BYTES_PER_PIXEL;
+	for (int ty = 0; ty < tilesDown; ty++) {
+		for (int tx = 0; tx < tilesAcross; tx++) {
+			int tile = ty * tilesAcross + tx;
+			int x = tx * FB_TILE_SIZE;
+			int bytes = glm::min(FB_TILE_SIZE, width - x) * BYTES_PER_PIXEL;
+			for (int row = 0; row < FB_TILE_SIZE; row++) {
+				int y = ty * FB_TILE_SIZE + row;
+				if (y >= height) {
+					break;
+				}
+				const GLubyte* src = colorTileCleared[tile] ? clearPattern :
+					colorBuffer + tile * FB_TILE_AREA * BYTES_PER_PIXEL + row * TILE_ROW_BYTES;
+				std::memcpy(exportBuffer + BYTES_PER_PIXEL * (y * width + x), src, bytes);
+			}
+		}
+	}
+	return exportBuffer;
+}
+
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
  * @brief	Shows the contents of the color buffer to screen.
@@ -105,10 +221,39 @@ void FrameBuffer::clearDepthBuffer() {
 
 void FrameBuffer::showColorBuffer() const {
 	glRasterPos2d(-1, -1);
-	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
+	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, getRowMajorColorBuffer());
 	glFlush();
 }
 
+/**
+ * @fn	void FrameBuffer::writeColorBufferToFile(const std::string& ppmFileName) const
+ * @brief	Writes the color buffer to a binary (P6) PPM file.
+ * @param	ppmFileName	Name of the file.
+ */
+
+void FrameBuffer::writeColorBufferToFile(const std::string& ppmFileName) const {
+	std::ofstream output(ppmFileName, std::ios::binary);
+	if (!output) {
+		std::cerr << "Cannot write " << ppmFileName << endl;
+		return;
+	}
+	writeColorBuffer(output);
+}
+
+/**
+ * @fn	void FrameBuffer::writeColorBuffer(std::ostream& output) const
+ * @brief	Writes the color buffer to a stream, as a binary (P6) PPM image.
+ * @param [in,out]	output	The stream.
+ */
+
+void FrameBuffer::writeColorBuffer(std::ostream& output) const {
+	output << "P6\n" << width << " " << height << "\n255\n";
+	const GLubyte* pixels = getRowMajorColorBuffer();
+	for (int y = height - 1; y >= 0; y--) {		// PPM files start with the top row
+		output.write((const char*)(pixels + BYTES_PER_PIXEL * y * width), BYTES_PER_PIXEL * width);
+	}
+}
+
 /**
  * @fn	void FrameBuffer::setColor(int x, int y, const color &rgb)
  * @brief	Sets a color at (x, y)
@@ -128,7 +273,255 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 					(GLubyte)(clampedColor.g * 255),
 					(GLubyte)(clampedColor.b * 255) };
 
-	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), c, BYTES_PER_PIXEL);
+	int tile = tileIndex(x, y);
+	if (colorTileCleared[tile]) {
+		materializeColorTile(tile);
+	}
+	std::memcpy(colorBuffer + BYTES_PER_PIXEL * pixelIndex(x, y), c, BYTES_PER_PIXEL);
+}
+
+/**
+ * @fn	static void convertChannels(const double* src, GLubyte* dst, int n)
+ * @brief	Clamps n color channels to [0, 1] and quantizes them, as setColor does.
+ * @param	src	The channels.
+ * @param	dst	Where the bytes go.
+ * @param	n  	Number of channels.
+ */
+
+static void convertChannels(const double* src, GLubyte* dst, int n) {
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d scale = _mm_set1_pd(255.0);
+	for (; i + 4 <= n; i += 4) {
+		__m128d a = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(src + i), zero), one);
+		__m128d b = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(src + i + 2), zero), one);
+		__m128i v = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_mul_pd(a, scale)),
+			_mm_cvttpd_epi32(_mm_mul_pd(b, scale)));
+		v = _mm_packs_epi32(v, v);
+		int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+		std::memcpy(dst + i, &bytes, 4);
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = (GLubyte)(glm::clamp(src[i], 0.0, 1.0) * 255);
+	}
+}
+
+/**
+ * @fn	static void convertChannels(const float* src, GLubyte* dst, int n)
+ * @brief	Clamps n color channels to [0, 1] and quantizes them, as setColor does.
+ * @param	src	The channels.
+ * @param	dst	Where the bytes go.
+ * @param	n  	Number of channels.
+ */
+
+static void convertChannels(const float* src, GLubyte* dst, int n) {
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	for (; i + 4 <= n; i += 4) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one);
+		__m128i v = _mm_cvttps_epi32(_mm_mul_ps(a, scale));
+		v = _mm_packs_epi32(v, v);
+		int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+		std::memcpy(dst + i, &bytes, 4);
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = (GLubyte)(glm::clamp(src[i], 0.0f, 1.0f) * 255);
+	}
+}
+
+/**
+ * @fn	static void convertDepths(const double* src, float* dst, int n)
+ * @brief	Converts n depths to the framebuffer's float depths.
+ * @param	src	The depths.
+ * @param	dst	Where the depths go.
+ * @param	n  	Number of depths.
+ */
+
+static void convertDepths(const double* src, float* dst, int n) {
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	for (; i + 4 <= n; i += 4) {
+		__m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+		__m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+		_mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = (float)src[i];
+	}
+}
+
+/**
+ * @fn	static void convertDepths(const float* src, float* dst, int n)
+ * @brief	Copies n depths.
+ * @param	src	The depths.
+ * @param	dst	Where the depths go.
+ * @param	n  	Number of depths.
+ */
+
+static void convertDepths(const float* src, float* dst, int n) {
+	std::memcpy(dst, src, n * sizeof(float));
+}
+
+/**
+ * @fn	template <class T> void FrameBuffer::writeSpan(int x, int y, int count, const T* rgb, const T* depths)
+ * @brief	Writes a run of pixels in row y, starting at x. The run is clipped to
+ * 			the window and split where it crosses tiles; within a tile the row
+ * 			is contiguous, so each piece is converted in one call.
+ * @tparam	T	double or float.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	Number of pixels.
+ * @param	rgb   	3 * count channels, or nullptr to leave the colors alone.
+ * @param	depths	count depths, or nullptr to leave the depths alone.
+ */
+
+template <class T>
+void FrameBuffer::writeSpan(int x, int y, int count, const T* rgb, const T* depths) {
+	if (y < 0 || y >= height) {
+		return;
+	}
+	if (x < 0) {
+		if (rgb != nullptr) rgb -= BYTES_PER_PIXEL * x;
+		if (depths != nullptr) depths -= x;
+		count += x;
+		x = 0;
+	}
+	count = glm::min(count, width - x);
+	while (count > 0) {
+		int tile = tileIndex(x, y);
+		int n = glm::min(count, FB_TILE_SIZE - (x & (FB_TILE_SIZE - 1)));
+		int index = pixelIndex(x, y);
+		if (rgb != nullptr) {
+			if (colorTileCleared[tile]) {
+				materializeColorTile(tile);
+			}
+			convertChannels(rgb, colorBuffer + BYTES_PER_PIXEL * index, BYTES_PER_PIXEL * n);
+			rgb += BYTES_PER_PIXEL * n;
+		}
+		if (depths != nullptr) {
+			if (depthTileCleared[tile]) {
+				materializeDepthTile(tile);
+			}
+			convertDepths(depths, depthBuffer + index, n);
+			depthBoundsStale[tile] = 1;
+			depths += n;
+		}
+		x += n;
+		count -= n;
+	}
+}
+
+static_assert(sizeof(color) == 3 * sizeof(double), "spans treat colors as packed doubles");
+
+/**
+ * @fn	void FrameBuffer::setColorSpan(int x, int y, int count, const color* colors)
+ * @brief	Sets the colors of count consecutive pixels in a row.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	Number of pixels.
+ * @param	colors	The colors.
+ */
+
+void FrameBuffer::setColorSpan(int x, int y, int count, const color* colors) {
+	writeSpan<double>(x, y, count, (const double*)colors, nullptr);
+}
+
+/**
+ * @fn	void FrameBuffer::setColorSpan(int x, int y, int count, const float* rgb)
+ * @brief	Sets the colors of count consecutive pixels in a row.
+ * @param	x	 	The x coordinate of the first pixel.
+ * @param	y	 	The y coordinate.
+ * @param	count	Number of pixels.
+ * @param	rgb  	The colors, as 3 * count floats.
+ */
+
+void FrameBuffer::setColorSpan(int x, int y, int count, const float* rgb) {
+	writeSpan<float>(x, y, count, rgb, nullptr);
+}
+
+/**
+ * @fn	void FrameBuffer::fillColorSpan(int x, int y, int count, const color& C)
+ * @brief	Sets count consecutive pixels in a row to a single color.
+ * @param	x	 	The x coordinate of the first pixel.
+ * @param	y	 	The y coordinate.
+ * @param	count	Number of pixels.
+ * @param	C	 	The color.
+ */
+
+void FrameBuffer::fillColorSpan(int x, int y, int count, const color& C) {
+	color run[FB_TILE_SIZE];
+	std::fill(run, run + FB_TILE_SIZE, C);
+	for (int i = 0; i < count; i += FB_TILE_SIZE) {
+		setColorSpan(x + i, y, glm::min(FB_TILE_SIZE, count - i), run);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setPixelSpan(int x, int y, int count, const color* colors, const double* depths)
+ * @brief	Sets the colors and depths of count consecutive pixels in a row.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	Number of pixels.
+ * @param	colors	The colors.
+ * @param	depths	The depths.
+ */
+
+void FrameBuffer::setPixelSpan(int x, int y, int count, const color* colors, const double* depths) {
+	writeSpan<double>(x, y, count, (const double*)colors, depths);
+}
+
+/**
+ * @fn	void FrameBuffer::setPixelSpan(int x, int y, int count, const float* rgb, const float* depths)
+ * @brief	Sets the colors and depths of count consecutive pixels in a row.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	Number of pixels.
+ * @param	rgb   	The colors, as 3 * count floats.
+ * @param	depths	The depths.
+ */
+
+void FrameBuffer::setPixelSpan(int x, int y, int count, const float* rgb, const float* depths) {
+	writeSpan<float>(x, y, count, rgb, depths);
+}
+
+/**
+ * @fn	void FrameBuffer::setColorTile(int x, int y, int w, int h, const color* colors)
+ * @brief	Sets the colors of a w x h block of pixels whose lower left corner is (x, y).
+ * @param	x	  	The x coordinate of the lower left corner.
+ * @param	y	  	The y coordinate of the lower left corner.
+ * @param	w	  	Width of the block.
+ * @param	h	  	Height of the block.
+ * @param	colors	w * h colors, row-major, bottom row first.
+ */
+
+void FrameBuffer::setColorTile(int x, int y, int w, int h, const color* colors) {
+	for (int row = 0; row < h; row++) {
+		setColorSpan(x, y + row, w, colors + row * w);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setColorTile(int x, int y, int w, int h, const float* rgb)
+ * @brief	Sets the colors of a w x h block of pixels whose lower left corner is (x, y).
+ * @param	x  	The x coordinate of the lower left corner.
+ * @param	y  	The y coordinate of the lower left corner.
+ * @param	w  	Width of the block.
+ * @param	h  	Height of the block.
+ * @param	rgb	3 * w * h floats, row-major, bottom row first.
+ */
+
+void FrameBuffer::setColorTile(int x, int y, int w, int h, const float* rgb) {
+	for (int row = 0; row < h; row++) {
+		setColorSpan(x, y + row, w, rgb + BYTES_PER_PIXEL * row * w);
+	}
 }
 
 /**
@@ -146,7 +539,9 @@ color FrameBuffer::getColor(int x, int y) const {
 		GLubyte c[BYTES_PER_PIXEL];
 
 		// Retrieve color values from the color buffer
-		std::memcpy(c, colorBuffer + BYTES_PER_PIXEL * (x + y * width), BYTES_PER_PIXEL);
+		const GLubyte* src = colorTileCleared[tileIndex(x, y)] ? clearPattern :
+			colorBuffer + BYTES_PER_PIXEL * pixelIndex(x, y);
+		std::memcpy(c, src, BYTES_PER_PIXEL);
 
 		// Convert individual color components back to doubleing point values
 		red = c[0] / 255.0;
@@ -182,7 +577,12 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		int tile = tileIndex(x, y);
+		if (depthTileCleared[tile]) {
+			materializeDepthTile(tile);
+		}
+		depthBuffer[pixelIndex(x, y)] = (float)depth;
+		depthBoundsStale[tile] = 1;
 	}
 }
 
@@ -196,7 +596,7 @@ void FrameBuffer::setDepth(int x, int y, double depth) {
 
 double FrameBuffer::getDepth(int x, int y) const {
 	if (checkInWindow(x, y)) {
-		return depthBuffer[y * width + x];
+		return depthTileCleared[tileIndex(x, y)] ? 1.0 : depthBuffer[pixelIndex(x, y)];
 	} else {
 		return 0.0;
 	}
@@ -214,6 +614,70 @@ double FrameBuffer::getDepth(double x, double y) const {
 	return getDepth((int)(x), (int)(y));
 }
 
+/**
+ * @fn	void FrameBuffer::getDepthBounds(int x0, int y0, int x1, int y1,
+ *										double& minDepth, double& maxDepth)
+ * @brief	Gets bounds on the depths in a rectangle, from the least and greatest
+ * 			depths of the tiles it touches. The bounds are conservative: every
+ * 			depth in the rectangle is in [minDepth, maxDepth]. A tile's bounds
+ * 			are found again only if it has been written since they were found.
+ * @param	x0			 	Left column of the rectangle.
+ * @param	y0			 	Bottom row of the rectangle.
+ * @param	x1			 	Right column of the rectangle.
+ * @param	y1			 	Top row of the rectangle.
+ * @param [out]	minDepth	Least depth.
+ * @param [out]	maxDepth	Greatest depth.
+ */
+
+void FrameBuffer::getDepthBounds(int x0, int y0, int x1, int y1, double& minDepth, double& maxDepth) {
+	x0 = glm::max(x0, 0);
+	y0 = glm::max(y0, 0);
+	x1 = glm::min(x1, width - 1);
+	y1 = glm::min(y1, height - 1);
+	if (x0 > x1 || y0 > y1) {
+		minDepth = maxDepth = 1.0;
+		return;
+	}
+	float least = FLT_MAX;
+	float greatest = -FLT_MAX;
+	for (int ty = y0 >> FB_TILE_BITS; ty <= y1 >> FB_TILE_BITS; ty++) {
+		for (int tx = x0 >> FB_TILE_BITS; tx <= x1 >> FB_TILE_BITS; tx++) {
+			int tile = ty * tilesAcross + tx;
+			if (depthTileCleared[tile]) {
+				least = glm::min(least, 1.0f);
+				greatest = glm::max(greatest, 1.0f);
+				continue;
+			}
+			if (depthBoundsStale[tile]) {
+				updateDepthBounds(tile);
+			}
+			least = glm::min(least, tileMinDepth[tile]);
+			greatest = glm::max(greatest, tileMaxDepth[tile]);
+		}
+	}
+	minDepth = least;
+	maxDepth = greatest;
+}
+
+/**
+ * @fn	void FrameBuffer::updateDepthBounds(int tile)
+ * @brief	Finds the least and greatest depths in a tile that has been written.
+ * @param	tile	Index of the tile.
+ */
+
+void FrameBuffer::updateDepthBounds(int tile) {
+	const float* depths = depthBuffer + tile * FB_TILE_AREA;
+	float least = depths[0];
+	float greatest = depths[0];
+	for (int i = 1; i < FB_TILE_AREA; i++) {
+		least = glm::min(least, depths[i]);
+		greatest = glm::max(greatest, depths[i]);
+	}
+	tileMinDepth[tile] = least;
+	tileMaxDepth[tile] = greatest;
+	depthBoundsStale[tile] = 0;
+}
+
 /**
  * @fn	bool FrameBuffer::checkInWindow(int x, int y) const
  * @brief	Returns true iff (x, y) is a valid window coordinate.
@@ -396,3 +860,298 @@ void FrameBuffer::showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
 		}
 	}
 }
+
+/**
+ * @fn	void FrameBuffer::setAccumulation(bool enable)
+ * @brief	Allocates (and clears) or frees the accumulation buffer.
+ * @param	enable	True to accumulate samples in float precision.
+ */
+
+void FrameBuffer::setAccumulation(bool enable) {
+	if (enable == isAccumulating()) {
+		return;
+	}
+	delete[] accumBuffer;
+	accumBuffer = nullptr;
+	if (enable) {
+		accumBuffer = new float[getPaddedArea() * ACCUM_CHANNELS];
+		clearAccumBuffer();
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearAccumBuffer()
+ * @brief	Discards all accumulated samples.
+ */
+
+void FrameBuffer::clearAccumBuffer() {
+	accumulatedPasses = 0;
+	if (accumBuffer != nullptr) {
+		std::fill(accumBuffer, accumBuffer + getPaddedArea() * ACCUM_CHANNELS, 0.0f);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::swapAccumBuffers(FrameBuffer& other)
+ * @brief	Exchanges accumulation buffers with another framebuffer, without
+ * 			copying. Lets accumulation continue when rendering alternates between
+ * 			two framebuffers. If their sizes differ, the accumulated samples are
+ * 			discarded.
+ * @param [in,out]	other	The other framebuffer.
+ */
+
+void FrameBuffer::swapAccumBuffers(FrameBuffer& other) {
+	std::swap(accumBuffer, other.accumBuffer);
+	std::swap(accumulatedPasses, other.accumulatedPasses);
+	if (width != other.width || height != other.height) {
+		for (FrameBuffer* fb : { this, &other }) {
+			if (fb->isAccumulating()) {
+				fb->setAccumulation(false);
+				fb->setAccumulation(true);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::accumulateColor(int x, int y, const color& C, double weight)
+ * @brief	Adds a weighted sample to the accumulation buffer at (x, y). The color
+ * 			is not clamped, so values above 1 survive until the resolve.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	C	  	The sample's color.
+ * @param	weight	The sample's weight.
+ */
+
+void FrameBuffer::accumulateColor(int x, int y, const color& C, double weight) {
+	if (accumBuffer == nullptr || !checkInWindow(x, y)) {
+		return;
+	}
+	float* sum = accumBuffer + ACCUM_CHANNELS * pixelIndex(x, y);
+	sum[0] += (float)(weight * C.r);
+	sum[1] += (float)(weight * C.g);
+	sum[2] += (float)(weight * C.b);
+	sum[3] += (float)weight;
+}
+
+/**
+ * @fn	void FrameBuffer::setResolveParameters(double exposure, double gamma, bool toneMap)
+ * @brief	Sets how resolveAccumBuffer converts accumulated colors to bytes.
+ * 			The defaults (1, 1, false) match setColor, except that they round.
+ * @param	exposure	Scale applied to the averaged color.
+ * @param	gamma   	Display gamma. 2.2 is typical of monitors.
+ * @param	toneMap 	True for the Reinhard operator c / (1 + c), false to clamp.
+ */
+
+void FrameBuffer::setResolveParameters(double exposure, double gamma, bool toneMap) {
+	this->exposure = exposure;
+	this->gamma = gamma;
+	this->toneMap = toneMap;
+	for (int i = 0; i < GAMMA_LUT_SIZE; i++) {
+		double intensity = std::pow(i / (GAMMA_LUT_SIZE - 1.0), 1.0 / gamma);
+		gammaLUT[i] = (GLubyte)(intensity * 255.0 + 0.5);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::resolveAccumBuffer()
+ * @brief	Converts the accumulation buffer into the color buffer. Each pixel is
+ * 			divided by its weight, exposed, tone mapped (or clamped), and then
+ * 			gamma corrected and quantized through gammaLUT. Pixels without samples
+ * 			get the clear color. Counts as one accumulated pass.
+ */
+
+void FrameBuffer::resolveAccumBuffer() {
+	if (accumBuffer == nullptr) {
+		return;
+	}
+	const int area = getPaddedArea();
+	const float LUT_SCALE = (float)(GAMMA_LUT_SIZE - 1);
+#ifdef FRAMEBUFFER_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 exposed = _mm_set1_ps((float)exposure);
+	const __m128 lutScale = _mm_set1_ps(LUT_SCALE);
+	alignas(16) int index[4];
+	for (int i = 0; i < area; i++) {
+		const float* sum = accumBuffer + ACCUM_CHANNELS * i;
+		GLubyte* out = colorBuffer + BYTES_PER_PIXEL * i;
+		if (sum[3] <= 0.0f) {
+			std::memcpy(out, clearColorUB, BYTES_PER_PIXEL);
+			continue;
+		}
+		__m128 c = _mm_loadu_ps(sum);
+		__m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+		c = _mm_mul_ps(_mm_div_ps(c, w), exposed);
+		c = _mm_max_ps(c, zero);
+		if (toneMap) {
+			c = _mm_div_ps(c, _mm_add_ps(c, one));
+		} else {
+			c = _mm_min_ps(c, one);
+		}
+		_mm_store_si128((__m128i*)index, _mm_cvtps_epi32(_mm_mul_ps(c, lutScale)));
+		out[0] = gammaLUT[index[0]];
+		out[1] = gammaLUT[index[1]];
+		out[2] = gammaLUT[index[2]];
+	}
+#else
+	for (int i = 0; i < area; i++) {
+		const float* sum = accumBuffer + ACCUM_CHANNELS * i;
+		GLubyte* out = colorBuffer + BYTES_PER_PIXEL * i;
+		if (sum[3] <= 0.0f) {
+			std::memcpy(out, clearColorUB, BYTES_PER_PIXEL);
+			continue;
+		}
+		for (int ch = 0; ch < BYTES_PER_PIXEL; ch++) {
+			float c = std::max(sum[ch] / sum[3] * (float)exposure, 0.0f);
+			c = toneMap ? c / (1.0f + c) : std::min(c, 1.0f);
+			out[ch] = gammaLUT[(int)(c * LUT_SCALE + 0.5f)];
+		}
+	}
+#endif
+	std::fill(colorTileCleared.begin(), colorTileCleared.end(), 0);
+	accumulatedPasses++;
+}
+
+/**
+ * @fn	void FrameBuffer::setDeferred(bool enable)
+ * @brief	Allocates (and empties) or frees the G-buffer. While it exists,
+ * 			fragment processing writes it instead of shading, and shadeGBuffer
+ * 			lights each covered pixel once.
+ * @param	enable	True for deferred shading.
+ */
+
+void FrameBuffer::setDeferred(bool enable) {
+	if (enable == isDeferred()) {
+		return;
+	}
+	delete[] gBuffer;
+	delete[] gMaterialIds;
+	gBuffer = nullptr;
+	gMaterialIds = nullptr;
+	gMaterials.clear();
+	gMaterialIndex.clear();
+	if (enable) {
+		gBuffer = new float[getPaddedArea() * GBUFFER_PLANES];
+		gMaterialIds = new int[getPaddedArea()];
+		std::fill(gMaterialIds, gMaterialIds + getPaddedArea(), -1);
+	}
+}
+
+/**
+ * @fn	int FrameBuffer::getMaterialId(const Material* material)
+ * @brief	Finds a material in the G-buffer's palette by its address, adding a
+ * 			copy if it is not there, or if the material at that address has
+ * 			changed since. This takes a lock, so it is called once per triangle
+ * 			or line, before its fragments are made, never per fragment.
+ * @param	material	The material.
+ * @return	Index of the material in the palette, or -1 if shading is not deferred.
+ */
+
+int FrameBuffer::getMaterialId(const Material* material) {
+	if (!isDeferred()) {
+		return -1;
+	}
+	std::lock_guard<std::mutex> lock(gMaterialsMutex);
+	auto found = gMaterialIndex.find(material);
+	if (found != gMaterialIndex.end() && gMaterials[found->second] == *material) {
+		return found->second;
+	}
+	const int id = (int)gMaterials.size();
+	gMaterials.push_back(*material);
+	gMaterialIndex[material] = id;
+	return id;
+}
+
+/**
+ * @fn	void FrameBuffer::setDepthSpan(int x, int y, int count, const double* depths)
+ * @brief	Sets the depths of count consecutive pixels in a row.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate.
+ * @param	count 	Number of pixels.
+ * @param	depths	The depths.
+ */
+
+void FrameBuffer::setDepthSpan(int x, int y, int count, const double* depths) {
+	writeSpan<double>(x, y, count, nullptr, depths);
+}
+
+/**
+ * @fn	void FrameBuffer::setGBufferSpan(int x, int y, int count, const dvec3* normals,
+ *										const dvec3* worldPositions, const int* materialIds)
+ * @brief	Writes the G-buffer for count consecutive pixels in a row.
+ * @param	x			  	The x coordinate of the first pixel.
+ * @param	y			  	The y coordinate.
+ * @param	count		  	Number of pixels.
+ * @param	normals		  	World normals.
+ * @param	worldPositions	World positions.
+ * @param	materialIds   	Palette indices, from getMaterialId.
+ */
+
+void FrameBuffer::setGBufferSpan(int x, int y, int count, const dvec3* normals,
+	const dvec3* worldPositions, const int* materialIds) {
+	const int area = getPaddedArea();
+	for (int i = 0; i < count; i++) {
+		if (!checkInWindow(x + i, y)) {
+			continue;
+		}
+		int tile = tileIndex(x + i, y);
+		if (depthTileCleared[tile]) {
+			materializeDepthTile(tile);
+		}
+		int index = pixelIndex(x + i, y);
+		for (int c = 0; c < 3; c++) {
+			gBuffer[c * area + index] = (float)normals[i][c];
+			gBuffer[(3 + c) * area + index] = (float)worldPositions[i][c];
+		}
+		gMaterialIds[index] = materialIds[i];
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::shadeGBuffer(const std::function<void(GBufferTile& tile)>& shade)
+ * @brief	The deferred lighting pass. The covered pixels of each tile are
+ * 			gathered, shade computes their colors, and they are written to the
+ * 			color buffer. Tiles are shaded in parallel, and tiles nothing was
+ * 			drawn into are skipped, so the cost depends on the number of covered
+ * 			pixels, not on how many fragments were drawn over them.
+ * @param	shade	Lights the pixels of a tile. Called from several threads.
+ */
+
+void FrameBuffer::shadeGBuffer(const std::function<void(GBufferTile& tile)>& shade) {
+	if (!isDeferred()) {
+		return;
+	}
+	const int area = getPaddedArea();
+	ThreadPool::shared().parallelFor(tilesAcross * tilesDown, [&](int tile) {
+		if (depthTileCleared[tile]) {
+			return;
+		}
+		GBufferTile gathered;
+		gathered.count = 0;
+		const int x0 = (tile % tilesAcross) * FB_TILE_SIZE;
+		const int y0 = (tile / tilesAcross) * FB_TILE_SIZE;
+		for (int i = 0; i < FB_TILE_AREA; i++) {
+			int index = tile * FB_TILE_AREA + i;
+			if (gMaterialIds[index] < 0) {
+				continue;
+			}
+			int n = gathered.count++;
+			gathered.x[n] = x0 + (i & (FB_TILE_SIZE - 1));
+			gathered.y[n] = y0 + (i >> FB_TILE_BITS);
+			gathered.depth[n] = depthBuffer[index];
+			for (int c = 0; c < 3; c++) {
+				gathered.normal[c][n] = gBuffer[c * area + index];
+				gathered.worldPos[c][n] = gBuffer[(3 + c) * area + index];
+			}
+			gathered.material[n] = &gMaterials[gMaterialIds[index]];
+		}
+		if (gathered.count == 0) {
+			return;
+		}
+		shade(gathered);
+		for (int n = 0; n < gathered.count; n++) {
+			setColor(gathered.x[n], gathered.y[n], gathered.colors[n]);
+		}
+	});
+}
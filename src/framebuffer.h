@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
@@ -18,12 +21,46 @@
 #endif
 
 const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int ACCUM_CHANNELS = 4;			//!< Accumulation buffer holds r, g, b and weight.
+const int GAMMA_LUT_SIZE = 4096;		//!< Entries in the resolve's gamma table.
+const int FB_TILE_BITS = 3;				//!< log2 of the framebuffer tile size.
+const int FB_TILE_SIZE = 1 << FB_TILE_BITS;	//!< Framebuffer tiles are 8x8 pixels.
+const int FB_TILE_AREA = FB_TILE_SIZE * FB_TILE_SIZE;
+const int CLEAR_PATTERN_PIXELS = 16;	//!< 16 RGB pixels fill three 16 byte registers.
+const int GBUFFER_PLANES = 6;			//!< G-buffer holds normal x, y, z and world position x, y, z.
+
+/**
+ * @struct	GBufferTile
+ * @brief	The covered pixels of one framebuffer tile, gathered for the deferred
+ * 			lighting pass, which lights them one pixel at a time and fills in
+ * 			colors. Each attribute is its own array, copied straight from the
+ * 			G-buffer's planes.
+ */
+
+struct GBufferTile {
+	int count;									//!< Number of covered pixels
+	int x[FB_TILE_AREA];						//!< Window x of each pixel
+	int y[FB_TILE_AREA];						//!< Window y of each pixel
+	float depth[FB_TILE_AREA];					//!< Depth of each pixel
+	float normal[3][FB_TILE_AREA];				//!< World normal, one array per component
+	float worldPos[3][FB_TILE_AREA];			//!< World position, one array per component
+	const Material* material[FB_TILE_AREA];		//!< Material of each pixel
+	color colors[FB_TILE_AREA];					//!< Output: lit color of each pixel
+};
 
 /**
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * 			depth at each pixel. Both are stored as 8x8 tiles, each row-major
+ * 			inside. Clearing only flags the tiles as cleared; a tile is filled
+ * 			with the clear value when it is first written. The least and
+ * 			greatest depth of each tile are kept for hierarchical Z. In deferred
+ * 			mode, a G-buffer holds the normal, world position and material of
+ * 			the fragment that won each pixel, for a later lighting pass.
+ * 			Optionally, a float accumulation buffer sums weighted samples at
+ * 			full precision, and is resolved (tone mapped, gamma corrected and
+ * 			quantized) into the color buffer.
  */
 
 struct FrameBuffer {
@@ -39,6 +76,9 @@ struct FrameBuffer {
 	void clearColorBuffer();
 	void clearDepthBuffer();
 	void showColorBuffer() const;
+	const GLubyte* getRowMajorColorBuffer() const;
+	void writeColorBufferToFile(const std::string& ppmFileName) const;
+	void writeColorBuffer(std::ostream& output) const;
 	int getWindowWidth() const { return width; }
 	int getWindowHeight() const { return height; }
 
@@ -46,17 +86,72 @@ struct FrameBuffer {
 	void setDepth(int x, int y, double depth);
 	double getDepth(int x, int y) const;
 	double getDepth(double x, double y) const;
+	void getDepthBounds(int x0, int y0, int x1, int y1, double& minDepth, double& maxDepth);
 
 	void showAxes(int x, int y, const Ray& ray, double thickness);
 	void showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
 		const BoundingBoxi& viewport);
 	void setPixel(int x, int y, const color& C, double depth);
+	void setColorSpan(int x, int y, int count, const color* colors);
+	void setColorSpan(int x, int y, int count, const float* rgb);
+	void fillColorSpan(int x, int y, int count, const color& C);
+	void setPixelSpan(int x, int y, int count, const color* colors, const double* depths);
+	void setPixelSpan(int x, int y, int count, const float* rgb, const float* depths);
+	void setColorTile(int x, int y, int w, int h, const color* colors);
+	void setColorTile(int x, int y, int w, int h, const float* rgb);
+
+	void setAccumulation(bool enable);
+	bool isAccumulating() const { return accumBuffer != nullptr; }
+	void clearAccumBuffer();
+	void accumulateColor(int x, int y, const color& C, double weight = 1.0);
+	int getAccumulatedPasses() const { return accumulatedPasses; }
+	void swapAccumBuffers(FrameBuffer& other);
+	void setResolveParameters(double exposure, double gamma, bool toneMap);
+	void resolveAccumBuffer();
+
+	void setDeferred(bool enable);
+	bool isDeferred() const { return gBuffer != nullptr; }
+	int getMaterialId(const Material* material);
+	void setDepthSpan(int x, int y, int count, const double* depths);
+	void setGBufferSpan(int x, int y, int count, const dvec3* normals, const dvec3* worldPositions,
+		const int* materialIds);
+	void shadeGBuffer(const std::function<void(GBufferTile& tile)>& shade);
 protected:
 	bool checkInWindow(int x, int y) const;
+	int tileIndex(int x, int y) const { return (y >> FB_TILE_BITS) * tilesAcross + (x >> FB_TILE_BITS); }
+	int pixelIndex(int x, int y) const {
+		return tileIndex(x, y) * FB_TILE_AREA +
+			((y & (FB_TILE_SIZE - 1)) << FB_TILE_BITS) + (x & (FB_TILE_SIZE - 1));
+	}
+	int getPaddedArea() const { return tilesAcross * tilesDown * FB_TILE_AREA; }
+	void materializeColorTile(int tile);
+	void materializeDepthTile(int tile);
+	void updateDepthBounds(int tile);
+	template <class T> void writeSpan(int x, int y, int count, const T* rgb, const T* depths);
 	int width;								//!< width of framebuffer
 	int height;								//!< height of framebuffer
+	int tilesAcross;						//!< Number of tiles in a row of tiles
+	int tilesDown;							//!< Number of rows of tiles
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
 	color clearColor;						//!< Clear color
-	GLubyte* colorBuffer;					//!< 2D array for holding colors
-	double* depthBuffer;					//!< 2D array for holding depths
+	GLubyte clearPattern[CLEAR_PATTERN_PIXELS * BYTES_PER_PIXEL];	//!< Color of cleared tiles, repeated
+	GLubyte* colorBuffer;					//!< Tiled array for holding colors
+	float* depthBuffer;						//!< Tiled array for holding depths
+	vector<unsigned char> colorTileCleared;	//!< Nonzero if a color tile holds only the clear color
+	vector<unsigned char> depthTileCleared;	//!< Nonzero if a depth tile holds only 1.0
+	vector<float> tileMinDepth;				//!< Least depth in each tile, for hierarchical Z
+	vector<float> tileMaxDepth;				//!< Greatest depth in each tile, for hierarchical Z
+	vector<unsigned char> depthBoundsStale;	//!< Nonzero if a tile was written since its bounds were found
+	mutable GLubyte* exportBuffer;			//!< Row-major copy of the colors, for display and files. Rewritten by getRowMajorColorBuffer
+	float* accumBuffer;						//!< Tiled array of (r, g, b, weight) sums, or nullptr
+	int accumulatedPasses;					//!< Resolves since the accumulation buffer was cleared
+	double exposure;						//!< Scale applied to colors before tone mapping
+	double gamma;							//!< Display gamma applied by the resolve
+	bool toneMap;							//!< Reinhard tone map if true, otherwise clamp
+	GLubyte gammaLUT[GAMMA_LUT_SIZE];		//!< [0, 1] intensity to gamma corrected byte
+	float* gBuffer;							//!< GBUFFER_PLANES tiled planes, or nullptr if not deferred
+	int* gMaterialIds;						//!< Tiled palette index per pixel, -1 if uncovered
+	vector<Material> gMaterials;			//!< Materials of the fragments in the G-buffer
+	std::unordered_map<const Material*, int> gMaterialIndex;	//!< Palette index of each material, by address
+	std::mutex gMaterialsMutex;				//!< Guards gMaterials while tiles are drawn in parallel
 };
\ No newline at end of file
@@ -11,6 +11,13 @@
 // Blue: z axis
 
 #include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "defs.h"
 #include "io.h"
 #include "ishape.h"
@@ -21,6 +28,12 @@
 #include "image.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "framebudget.h"
+#include "renderhistory.h"
+#include "denoiser.h"
+#include "renderfarm.h"
+#include "animationscript.h"
+#include "renderserver.h"
 
 int currLight = 0;
 double angle = 0.5;
@@ -31,6 +44,17 @@ bool isAnimated = false;
 int numReflections = 0;
 int antiAliasing = 1;
 bool multiViewOn = false;
+bool sceneChanged = true;
+int shadowSamples = 1;
+const int SOFT_SHADOW_SAMPLES = 16;
+bool budgetOn = false;
+bool checkerboardOn = false;
+bool secondaryCacheOn = false;
+bool denoiseOn = false;
+bool historyStale = false;			//!< True if something other than the camera changed.
+bool transparentMoved = false;		//!< True if the transparent plane moved.
+const char* CAMERA_KEYS = "[{]}=|Mm";
+const double FRAME_BUDGET_SECONDS = 0.033;
 double spotDirX = 0.05;
 double spotDirY = 0;
 double spotDirZ = -1;
@@ -52,27 +76,65 @@ vector<PositionalLightPtr> lights = {
 PositionalLightPtr posLight = lights[0];
 SpotLightPtr spotLight = (SpotLightPtr)lights[1];
 
-FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+// Frames are ray traced on a render thread, into the back buffer. When a frame
+// is done, the render thread swaps the front and back pointers, and the display
+// callback shows the front buffer. frontMutex guards the swap and the display.
+// stateMutex guards everything keyboard(), timer() and resize() change; the
+// render thread copies that state at the start of each frame. Input sets
+// cancelFrame, so a frame rendering stale state is abandoned and restarted.
+FrameBuffer* frontBuffer = new FrameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+FrameBuffer* backBuffer = new FrameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+std::mutex frontMutex;
+std::mutex stateMutex;
+std::condition_variable frameRequested;
+bool framePending = true;
+bool quitRendering = false;
+std::atomic<bool> frameReady(false);
+std::atomic<bool> cancelFrame(false);
+std::thread renderThread;
+int windowWidth = WINDOW_WIDTH;
+int windowHeight = WINDOW_HEIGHT;
+const int PRESENT_INTERVAL = 10;	//!< ms between checks for a finished frame.
+
 Image im1("usflag.ppm");
 Image im2("snail.ppm");
 RayTracer rayTrace(black);
+FrameBudget frameBudget(FRAME_BUDGET_SECONDS);
+RenderHistory renderHistory;
 IScene scene;
 
 void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
-	int width = frameBuffer.getWindowWidth();
-	int height = frameBuffer.getWindowHeight();
-	scene.camera = new PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, numReflections, scene);
-
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
-	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
-	cout << "Render time: " << totalTimeSec << " sec. " << endl;
+	std::lock_guard<std::mutex> lock(frontMutex);
+	frontBuffer->showColorBuffer();
+}
+
+/**
+ * @fn	void requestFrame()
+ * @brief	Asks the render thread for another frame. Caller holds stateMutex.
+ */
+
+void requestFrame() {
+	framePending = true;
+	frameRequested.notify_one();
+}
+
+/**
+ * @fn	void restartFrame()
+ * @brief	Abandons the frame being rendered, if any, and asks for a new one
+ * 			with the latest state. Caller holds stateMutex.
+ */
+
+void restartFrame() {
+	sceneChanged = true;
+	cancelFrame = true;
+	requestFrame();
 }
 
 void resize(int width, int height) {
-	frameBuffer.setFrameBufferSize(width, height);
-	glutPostRedisplay();
+	std::lock_guard<std::mutex> lock(stateMutex);
+	windowWidth = width;
+	windowHeight = height;
+	restartFrame();
 }
 
 IPlane* plane1 = new IPlane(dvec3(0.0, -20.0, 0.0), dvec3(0.5, 1.0, 0.0));
@@ -101,6 +163,166 @@ void buildScene() {
 
 	scene.addLight(lights[0]);
 	scene.addLight(lights[1]);
+	lights[0]->radius = 2.0;
+	lights[1]->radius = 2.0;
+}
+
+/**
+ * @struct	FrameState
+ * @brief	The render thread's copy of the state that input and animation change.
+ */
+
+struct FrameState {
+	dvec3 cameraPos, cameraFocus, cameraUp;
+	double cameraFOV;
+	int width, height;
+	int numReflections;
+	int antiAliasing;
+	int shadowSamples;
+	bool budgetOn;
+	bool checkerboard;
+	bool secondaryCache;
+	bool denoise;
+	bool clearHistory;			//!< True if the lights or settings changed, so history is stale.
+	bool transparentMoved;		//!< True if the transparent plane moved, so history seen through it is stale.
+	bool restartAccumulation;	//!< True if previously accumulated samples are stale.
+};
+
+PositionalLight renderPosLight = *posLight;
+SpotLight renderSpotLight = *spotLight;
+IPlane renderClearPlane = *clearPlane;
+IScene renderScene;
+
+/**
+ * @fn	void buildRenderScene()
+ * @brief	Builds the render thread's scene. It shares the objects that never
+ * 			change, and uses copies of the lights and the moving plane.
+ */
+
+void buildRenderScene() {
+	renderScene.opaqueObjs = scene.opaqueObjs;
+	renderScene.addTransparentObject(new TransparentIShape(&renderClearPlane, red, 0.25));
+	renderScene.addLight(&renderPosLight);
+	renderScene.addLight(&renderSpotLight);
+}
+
+/**
+ * @fn	FrameState snapshotState()
+ * @brief	Copies the current state for the next frame. Caller holds stateMutex.
+ * @return	The state of the frame.
+ */
+
+FrameState snapshotState() {
+	FrameState state = { cameraPos1, cameraFocus1, cameraUp1, cameraFOV,
+		windowWidth, windowHeight, numReflections, antiAliasing, shadowSamples, budgetOn,
+		checkerboardOn, secondaryCacheOn, denoiseOn, historyStale, transparentMoved,
+		sceneChanged || isAnimated };
+	renderPosLight = *posLight;
+	renderSpotLight = *spotLight;
+	renderClearPlane = *clearPlane;
+	sceneChanged = false;
+	historyStale = false;
+	transparentMoved = false;
+	cancelFrame = false;
+	return state;
+}
+
+/**
+ * @fn	void renderLoop()
+ * @brief	Body of the render thread. Waits for a frame request, renders into
+ * 			the back buffer and then swaps it to the front. While nothing moves,
+ * 			each frame adds another pass of jittered samples. A cancelled frame is
+ * 			never shown; the input that cancelled it has already asked for the next.
+ * 			In budget mode, quality is lowered while the scene changes, so that
+ * 			frames fit in FRAME_BUDGET_SECONDS, and restored once it stops.
+ * 			In checkerboard mode, each new frame only traces half of its pixels,
+ * 			and reuses the previous frame for the rest. With the secondary cache
+ * 			on, shadow and reflection rays are reused from the previous frame.
+ * 			Camera motion keeps the history, and so does the moving plane,
+ * 			except for what was seen through it. Denoising filters each frame
+ * 			with an edge-aware a-trous filter.
+ */
+
+void renderLoop() {
+	QualitySettings lastSettings = { 0, 0, 0, 0 };
+	while (true) {
+		FrameState state;
+		{
+			std::unique_lock<std::mutex> lock(stateMutex);
+			frameRequested.wait(lock, [] { return framePending || quitRendering; });
+			if (quitRendering) {
+				return;
+			}
+			framePending = false;
+			state = snapshotState();
+		}
+		auto frameStartTime = std::chrono::steady_clock::now();
+		// The accumulated samples belong to the latest frame, which is in front.
+		{
+			std::lock_guard<std::mutex> lock(frontMutex);
+			if (frontBuffer->isAccumulating()) {
+				backBuffer->swapAccumBuffers(*frontBuffer);
+			}
+		}
+		if (backBuffer->getWindowWidth() != state.width || backBuffer->getWindowHeight() != state.height) {
+			backBuffer->setFrameBufferSize(state.width, state.height);
+		}
+		const int numLights = (int)renderScene.lights.size();
+		QualitySettings settings = { 1, state.antiAliasing, state.numReflections, state.shadowSamples };
+		if (state.budgetOn) {
+			settings = frameBudget.chooseSettings(settings, state.restartAccumulation,
+				state.width, state.height, numLights);
+		}
+		if (state.restartAccumulation || settings != lastSettings) {
+			backBuffer->clearAccumBuffer();
+		}
+		PerspectiveCamera camera(state.cameraPos, state.cameraFocus, state.cameraUp,
+			state.cameraFOV, state.width, state.height);
+		renderScene.camera = &camera;
+		rayTrace.antiAliasing = settings.antiAliasing;
+		rayTrace.resolutionDivisor = settings.resolutionDivisor;
+		rayTrace.shadowSamples = settings.shadowSamples;
+		rayTrace.checkerboard = state.checkerboard;
+		rayTrace.cacheSecondary = state.secondaryCache;
+		rayTrace.denoiseIterations = state.denoise ? DENOISE_ITERATIONS : 0;
+		const bool keepHistory = state.checkerboard || state.secondaryCache;
+		rayTrace.history = keepHistory ? &renderHistory : nullptr;
+		if (!keepHistory || state.clearHistory || settings != lastSettings) {
+			renderHistory.clear();
+		} else if (state.transparentMoved) {
+			renderHistory.markTransparentMoved();
+		}
+		lastSettings = settings;
+		if (!rayTrace.raytraceScene(*backBuffer, settings.numReflections, renderScene, &cancelFrame)) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(frontMutex);
+			std::swap(frontBuffer, backBuffer);
+		}
+		frameReady = true;
+
+		double totalTimeSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStartTime).count();
+		frameBudget.recordFrame(settings, state.width, state.height, numLights, totalTimeSec);
+		cout << "Render time: " << totalTimeSec << " sec. ";
+		if (state.budgetOn) {
+			cout << "(" << settings << ")";
+		}
+		cout << endl;
+	}
+}
+
+/**
+ * @fn	void presentTimer(int id)
+ * @brief	Redisplays when the render thread has finished a frame.
+ * @param	id	Timer id.
+ */
+
+void presentTimer(int id) {
+	if (frameReady.exchange(false)) {
+		glutPostRedisplay();
+	}
+	glutTimerFunc(PRESENT_INTERVAL, presentTimer, 0);
 }
 
 void incrementClamp(double& v, double delta, double lo, double hi) {
@@ -112,6 +334,7 @@ void incrementClamp(int& v, int delta, int lo, int hi) {
 }
 
 void timer(int id) {
+	std::lock_guard<std::mutex> lock(stateMutex);
 	if (isAnimated) {
 		if (x <= -MAX) {
 			inc = -inc;
@@ -119,14 +342,16 @@ void timer(int id) {
 			inc = -inc;
 		}
 		x += inc;
+		transparentMoved = true;
 	}
 	clearPlane->a = dvec3(x, 0, 0);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
-	glutPostRedisplay();
+	requestFrame();
 }
 
 // You shouldn't need to edit this function
 void keyboard(unsigned char key, int x, int y) {
+	std::lock_guard<std::mutex> lock(stateMutex);
 	int W, H;
 	const double INC = 0.5;
 	switch (key) {
@@ -211,8 +436,8 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	case 'M':
 	case 'm':	incrementClamp(cameraFOV, isupper(key) ? 0.2 : -0.2, glm::radians(10.0), glm::radians(160.0));
-		W = frameBuffer.getWindowWidth();
-		H = frameBuffer.getWindowWidth();
+		W = windowWidth;
+		H = windowWidth;
 		cout << "camFOV: " << cameraFOV << endl;
 		break;
 	case '3':	antiAliasing = 3;
@@ -223,6 +448,21 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	case '?':	multiViewOn = !multiViewOn;
 		break;
+	case 'h':	shadowSamples = shadowSamples == 1 ? SOFT_SHADOW_SAMPLES : 1;
+		cout << "Shadow samples: " << shadowSamples << endl;
+		break;
+	case 't':	budgetOn = !budgetOn;
+		cout << "Frame budget: " << (budgetOn ? "On" : "Off") << endl;
+		break;
+	case 'k':	checkerboardOn = !checkerboardOn;
+		cout << "Checkerboard: " << (checkerboardOn ? "On" : "Off") << endl;
+		break;
+	case 'e':	secondaryCacheOn = !secondaryCacheOn;
+		cout << "Secondary ray cache: " << (secondaryCacheOn ? "On" : "Off") << endl;
+		break;
+	case 'o':	denoiseOn = !denoiseOn;
+		cout << "Denoise: " << (denoiseOn ? "On" : "Off") << endl;
+		break;
 	case '-':
 		numReflections = glm::max(numReflections - 1, 0);
 		cout << "Num reflections: " << numReflections << endl;
@@ -238,12 +478,217 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	default:
 		cout << (int)key << " unmapped key pressed." << endl;
+		return;
+	}
+
+	if (strchr(CAMERA_KEYS, key) == nullptr) {
+		historyStale = true;
+	}
+	restartFrame();
+}
+
+/**
+ * @struct	OfflineOptions
+ * @brief	Options of the modes that render without a window.
+ */
+
+struct OfflineOptions {
+	int numWorkers;			//!< Worker processes, one per core by default.
+	int width, height;		//!< Size of the frames.
+	std::string output;		//!< File name, or the prefix of the numbered frame files.
+};
+
+/**
+ * @fn	bool parseOfflineOptions(int argc, char* argv[], int first, OfflineOptions& options)
+ * @brief	Reads --workers N, --size W H, --aa N, --reflections N, --shadows N
+ * 			and --out name. Sets the options, or the matching globals.
+ * @param 		  	argc   	Number of command line arguments.
+ * @param 		  	argv   	The arguments.
+ * @param 		  	first  	Index of the first option.
+ * @param [in,out]	options	The options, already holding their defaults.
+ * @return	False if an option is unknown or the size is bad.
+ */
+
+bool parseOfflineOptions(int argc, char* argv[], int first, OfflineOptions& options) {
+	for (int i = first; i < argc; i++) {
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--workers") == 0 && hasValue) {
+			options.numWorkers = std::atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+			options.width = std::atoi(argv[++i]);
+			options.height = std::atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--aa") == 0 && hasValue) {
+			antiAliasing = std::atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--reflections") == 0 && hasValue) {
+			numReflections = std::atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--shadows") == 0 && hasValue) {
+			shadowSamples = std::atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+			options.output = argv[++i];
+		} else {
+			std::cerr << "Unknown option: " << argv[i] << endl;
+			return false;
+		}
+	}
+	if (options.width <= 0 || options.height <= 0) {
+		std::cerr << "Bad size: " << options.width << " x " << options.height << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	int renderStill(int argc, char* argv[])
+ * @brief	Ray traces a single frame without opening a window, sharing the tiles
+ * 			among worker processes (see RenderFarm), and writes it to a PPM file
+ * 			(still.ppm unless --out is given).
+ * @param	argc	Number of command line arguments.
+ * @param	argv	The arguments: --still, then options (see parseOfflineOptions).
+ * @return	Exit status.
+ */
+
+int renderStill(int argc, char* argv[]) {
+	OfflineOptions options = { (int)std::thread::hardware_concurrency(),
+		WINDOW_WIDTH, WINDOW_HEIGHT, "still.ppm" };
+	if (!parseOfflineOptions(argc, argv, 2, options)) {
+		return 1;
+	}
+
+	buildScene();
+	buildRenderScene();
+	FrameState state = snapshotState();
+	PerspectiveCamera camera(state.cameraPos, state.cameraFocus, state.cameraUp,
+		state.cameraFOV, options.width, options.height);
+	renderScene.camera = &camera;
+	rayTrace.antiAliasing = state.antiAliasing;
+	rayTrace.shadowSamples = state.shadowSamples;
+	FrameBuffer frameBuffer(options.width, options.height);
+
+	auto startTime = std::chrono::steady_clock::now();
+	RenderFarm farm(rayTrace, renderScene, state.numReflections, options.numWorkers);
+	farm.render(frameBuffer);
+	double totalTimeSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	cout << "Render time: " << totalTimeSec << " sec. (" << farm.getNumWorkers() << " workers)" << endl;
+	frameBuffer.writeColorBufferToFile(options.output);
+	return 0;
+}
+
+/**
+ * @fn	int renderBatch(int argc, char* argv[])
+ * @brief	Renders a range of animation frames without opening a window, each
+ * 			frame in a worker process (see RenderFarm::renderFrames), and writes
+ * 			them to numbered PPM files (frame00000.ppm, ... unless --out gives
+ * 			another prefix). The animation comes from a script of keyframes (see
+ * 			AnimationScript). Its parameters are camera.pos, camera.focus,
+ * 			camera.up and camera.fov (degrees); plane.x, the transparent plane's
+ * 			position; the centers of sphere1, sphere2, cylinder1, cylinder2 and
+ * 			cylinder3; and light0 (positional) and light1 (spot) .pos, .color
+ * 			and .radius, plus light1.dir and light1.fov. The cone is not offered,
+ * 			since its base disk is placed once, when it is made.
+ * @param	argc	Number of command line arguments.
+ * @param	argv	The arguments: --batch FIRST LAST SCRIPT, then options (see
+ * 					parseOfflineOptions).
+ * @return	Exit status.
+ */
+
+int renderBatch(int argc, char* argv[]) {
+	if (argc < 5) {
+		std::cerr << "Usage: " << argv[0] << " --batch FIRST LAST SCRIPT [options]" << endl;
+		return 1;
 	}
+	const int firstFrame = std::atoi(argv[2]);
+	const int lastFrame = std::atoi(argv[3]);
+	OfflineOptions options = { (int)std::thread::hardware_concurrency(),
+		WINDOW_WIDTH, WINDOW_HEIGHT, "frame" };
+	if (!parseOfflineOptions(argc, argv, 5, options)) {
+		return 1;
+	}
+
+	buildScene();
+	buildRenderScene();
+	double fovDegrees = glm::degrees(cameraFOV);
+	AnimationScript script;
+	script.bind("camera.pos", cameraPos1);
+	script.bind("camera.focus", cameraFocus1);
+	script.bind("camera.up", cameraUp1);
+	script.bind("camera.fov", fovDegrees);
+	script.bind("plane.x", x);
+	script.bind("sphere1.center", sphere1->center);
+	script.bind("sphere2.center", sphere2->center);
+	script.bind("cylinder1.center", cylinder1->center);
+	script.bind("cylinder2.center", cylinder2->center);
+	script.bind("cylinder3.center", cylinder3->center);
+	script.bind("light0.pos", posLight->pos);
+	script.bind("light0.color", posLight->lightColor);
+	script.bind("light0.radius", posLight->radius);
+	script.bind("light1.pos", spotLight->pos);
+	script.bind("light1.color", spotLight->lightColor);
+	script.bind("light1.radius", spotLight->radius);
+	script.bind("light1.dir", spotLight->spotDir);
+	script.bind("light1.fov", spotLight->fov);
+	if (!script.load(argv[4])) {
+		return 1;
+	}
+
+	FrameBuffer frameBuffer(options.width, options.height);
+	auto renderFrame = [&](int frame) {
+		script.apply(frame);
+		cameraFOV = glm::radians(fovDegrees);
+		clearPlane->a = dvec3(x, 0, 0);
+		spotLight->spotDir = glm::normalize(spotLight->spotDir);
+		FrameState state = snapshotState();
+		PerspectiveCamera camera(state.cameraPos, state.cameraFocus, state.cameraUp,
+			state.cameraFOV, options.width, options.height);
+		renderScene.camera = &camera;
+		rayTrace.antiAliasing = state.antiAliasing;
+		rayTrace.shadowSamples = state.shadowSamples;
+		rayTrace.raytraceScene(frameBuffer, state.numReflections, renderScene);
+		char fileName[32];
+		snprintf(fileName, sizeof(fileName), "%05d.ppm", frame);
+		frameBuffer.writeColorBufferToFile(options.output + fileName);
+		return true;
+	};
 
-	glutPostRedisplay();
+	auto startTime = std::chrono::steady_clock::now();
+	int rendered = RenderFarm::renderFrames(firstFrame, lastFrame, options.numWorkers, renderFrame);
+	double totalTimeSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	cout << "Rendered " << rendered << " frames in " << totalTimeSec << " sec. ("
+		<< rendered / totalTimeSec << " frames/sec)" << endl;
+	return rendered == lastFrame - firstFrame + 1 ? 0 : 1;
+}
+
+/**
+ * @fn	int serveRenders(int argc, char* argv[])
+ * @brief	Builds the scene once, then renders it on request as scene
+ * 			"fullraytrace" (see RenderServer) until a client sends "quit".
+ * @param	argc	Number of command line arguments.
+ * @param	argv	The arguments: --server SOCKET_PATH.
+ * @return	Exit status.
+ */
+
+int serveRenders(int argc, char* argv[]) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " --server SOCKET_PATH" << endl;
+		return 1;
+	}
+	buildScene();
+	buildRenderScene();
+	snapshotState();
+	RenderServer server(black);
+	server.addScene("fullraytrace", &renderScene);
+	return server.run(argv[2]) ? 0 : 1;
 }
 
 int main(int argc, char* argv[]) {
+	if (argc > 1 && strcmp(argv[1], "--still") == 0) {
+		return renderStill(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+		return renderBatch(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+		return serveRenders(argc, argv);
+	}
 	graphicsInit(argc, argv, __FILE__);
 
 	glutDisplayFunc(render);
@@ -251,9 +696,19 @@ int main(int argc, char* argv[]) {
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
+	glutTimerFunc(PRESENT_INTERVAL, presentTimer, 0);
+	backBuffer->setAccumulation(true);
 	buildScene();
+	buildRenderScene();
+	renderThread = std::thread(renderLoop);
 
 	glutMainLoop();
 
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		quitRendering = true;
+		frameRequested.notify_one();
+	}
+	renderThread.join();
 	return 0;
 }
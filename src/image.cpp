@@ -13,6 +13,7 @@
 #include <set>
 #include "utilities.h"
 #include "image.h"
+#include "io.h"
 
 static unsigned int getNextChar(std::ifstream& input, string& str) {
 	const int N = 2000;
@@ -30,8 +31,8 @@ static void p3(std::ifstream& input, Image& im) {
 	input >> im.W >> im.H >> maxValue;
 	input.getline(buf, N);
 
-	im.pixels = new color[im.W * im.H];
-	color* p = im.pixels;
+	color* texels = new color[im.W * im.H];
+	color* p = texels;
 	for (int row = 0; row < im.H; row++) {
 		for (int col = 0; col < im.W; col++, p++) {
 			int r, g, b;
@@ -42,6 +43,8 @@ static void p3(std::ifstream& input, Image& im) {
 			*p = color(R, G, B);
 		}
 	}
+	im.setTexels(texels);
+	delete[] texels;
 }
 
 static void p6(std::ifstream& input, Image& im) {
@@ -52,9 +55,9 @@ static void p6(std::ifstream& input, Image& im) {
 	input >> im.W >> im.H >> maxValue;
 	input.getline(buf, N);
 
-	im.pixels = new color[im.W * im.H];
+	color* texels = new color[im.W * im.H];
 	string buffer;
-	color* p = im.pixels;
+	color* p = texels;
 	for (int row = 0; row < im.H; row++) {
 		for (int col = 0; col < im.W; col++, p++) {
 			int r, g, b;
@@ -67,23 +70,42 @@ static void p6(std::ifstream& input, Image& im) {
 			*p = color(R, G, B);
 		}
 	}
+	im.setTexels(texels);
+	delete[] texels;
 }
 
 /**
- * @fn	Image::Image(char *ppmFileName)
+ * @fn	static int interleaveBits(int x, int y)
+ * @brief	Computes the Morton (Z-order) code of a texel within an 8x8 tile.
+ * @param	x	The x coordinate within the tile.
+ * @param	y	The y coordinate within the tile.
+ * @return	The bits of x and y interleaved, with x in the even bits.
+ */
+
+static int interleaveBits(int x, int y) {
+	x = (x | (x << 2)) & 0x33;
+	x = (x | (x << 1)) & 0x55;
+	y = (y | (y << 2)) & 0x33;
+	y = (y | (y << 1)) & 0x55;
+	return x | (y << 1);
+}
+
+/**
+ * @fn	Image::Image(char *ppmFileName, TexelLayout layout)
  * @brief	Constructs and image given the name of a PPM file. The file must be
  * 			P3 or P6.
  * @param [in,out]	ppmFileName	Filename of the ppm file.
+ * @param 		  	layout	   	How the texels are to be stored in memory.
  */
 
-Image::Image(std::string ppmFileName) : W(0), H(0) {
+Image::Image(std::string ppmFileName, TexelLayout layout)
+	: W(0), H(0), pixels(nullptr), layout(layout), tilesAcross(0), compressionPSNR(0.0) {
 	const int N = 100;
 	char buf1[N + 1];
 	char buf2[N + 1];
 	std::ifstream input(ppmFileName.c_str(), std::ios::binary);
 	input.getline(buf1, N);
 	int type = 3;
-	pixels = nullptr;
 
 	while (input.peek() == '#') {
 		input.getline(buf2, N);
@@ -100,6 +122,13 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
 	}
 
 	input.close();
+
+	if (layout == TexelLayout::BC1) {
+		size_t uncompressed = W * H * sizeof(color);
+		cout << ppmFileName << ": BC1 " << W << "x" << H << ", "
+			<< getTexelMemory() << " bytes (" << (double)uncompressed / getTexelMemory()
+			<< "x smaller), PSNR " << compressionPSNR << " dB" << endl;
+	}
 }
 
 /**
@@ -115,5 +144,256 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
 color Image::getPixelUV(double u, double v) const {
 	int x = glm::clamp((int)(W * u), 0, W - 1);
 	int y = glm::clamp((int)(H * v), 0, H - 1);
-	return pixels[y * W + x];
+	return getPixel(x, y);
+}
+
+/**
+ * @fn	color Image::getPixel(int x, int y) const
+ * @brief	Gets the texel in column x, row y, regardless of the memory layout.
+ * @param	x	The column.
+ * @param	y	The row.
+ * @return	The texel's color.
+ */
+
+color Image::getPixel(int x, int y) const {
+	if (layout == TexelLayout::BC1) {
+		return decodeBC1(x, y);
+	}
+	return pixels[texelIndex(x, y)];
+}
+
+/**
+ * @fn	int Image::texelIndex(int x, int y) const
+ * @brief	Maps a texel's (column, row) onto its position in pixels.
+ * @param	x	The column.
+ * @param	y	The row.
+ * @return	The index into pixels.
+ */
+
+int Image::texelIndex(int x, int y) const {
+	if (layout == TexelLayout::ROW_MAJOR) {
+		return y * W + x;
+	}
+	const int MASK = TEXEL_TILE_SIZE - 1;
+	int tile = (y >> TEXEL_TILE_BITS) * tilesAcross + (x >> TEXEL_TILE_BITS);
+	int inTile = layout == TexelLayout::TILED ?
+		((y & MASK) << TEXEL_TILE_BITS) + (x & MASK) :
+		interleaveBits(x & MASK, y & MASK);
+	return tile * TEXEL_TILE_AREA + inTile;
+}
+
+/**
+ * @fn	void Image::setTexels(const color* rowMajorTexels)
+ * @brief	Replaces the image's texels, storing them in the image's layout. For
+ * 			the tiled layouts, the image is padded out to whole tiles.
+ * @param	rowMajorTexels	W * H texels, in the order of the PPM file.
+ */
+
+void Image::setTexels(const color* rowMajorTexels) {
+	if (layout == TexelLayout::BC1) {
+		compressBC1(rowMajorTexels);
+		return;
+	}
+	int tilesDown = (H + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE;
+	tilesAcross = (W + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE;
+	int size = layout == TexelLayout::ROW_MAJOR ? W * H :
+		tilesAcross * tilesDown * TEXEL_TILE_AREA;
+
+	delete[] pixels;
+	pixels = new color[size];
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			pixels[texelIndex(x, y)] = rowMajorTexels[y * W + x];
+		}
+	}
+}
+
+/**
+ * @fn	size_t Image::getTexelMemory() const
+ * @brief	Gets the number of bytes used to hold the texels.
+ * @return	The size of pixels, or of blocks for BC1 images.
+ */
+
+size_t Image::getTexelMemory() const {
+	if (layout == TexelLayout::BC1) {
+		return blocks.size() * sizeof(BC1Block);
+	}
+	int tilesDown = (H + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE;
+	int size = layout == TexelLayout::ROW_MAJOR ? W * H :
+		tilesAcross * tilesDown * TEXEL_TILE_AREA;
+	return size * sizeof(color);
+}
+
+/**
+ * @fn	static unsigned short toRGB565(const color& C)
+ * @brief	Quantizes a color into 5 bits of red, 6 of green and 5 of blue.
+ * @param	C	The color, with components in [0, 1].
+ * @return	The packed color.
+ */
+
+static unsigned short toRGB565(const color& C) {
+	color c = glm::clamp(C, 0.0, 1.0);
+	int r = (int)(c.r * 31.0 + 0.5);
+	int g = (int)(c.g * 63.0 + 0.5);
+	int b = (int)(c.b * 31.0 + 0.5);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+/**
+ * @fn	static color fromRGB565(unsigned short packed)
+ * @brief	Expands a packed RGB565 color.
+ * @param	packed	The packed color.
+ * @return	The color, with components in [0, 1].
+ */
+
+static color fromRGB565(unsigned short packed) {
+	return color(((packed >> 11) & 31) / 31.0,
+		((packed >> 5) & 63) / 63.0,
+		(packed & 31) / 31.0);
+}
+
+/**
+ * @fn	static color paletteColor(const BC1Block& block, int index)
+ * @brief	Computes one of the four colors of a block's palette.
+ * @param	block	The block.
+ * @param	index	The palette index, 0-3.
+ * @return	The palette color.
+ */
+
+static color paletteColor(const BC1Block& block, int index) {
+	color c0 = fromRGB565(block.color0);
+	color c1 = fromRGB565(block.color1);
+	switch (index) {
+	case 0:		return c0;
+	case 1:		return c1;
+	case 2:		return block.color0 > block.color1 ? (2.0 * c0 + c1) / 3.0 : (c0 + c1) / 2.0;
+	default:	return block.color0 > block.color1 ? (c0 + 2.0 * c1) / 3.0 : black;
+	}
+}
+
+/**
+ * @fn	static BC1Block encodeBC1Block(const color texels[16])
+ * @brief	Compresses a block of 16 texels. The endpoints are the extremes of the
+ * 			texels along their principal axis, and each texel gets the nearest
+ * 			of the four palette colors.
+ * @param	texels	The 4x4 texels, row-major.
+ * @return	The compressed block.
+ */
+
+static BC1Block encodeBC1Block(const color texels[16]) {
+	const int N = BC1_BLOCK_SIZE * BC1_BLOCK_SIZE;
+	color mean;
+	for (int i = 0; i < N; i++) {
+		mean += texels[i];
+	}
+	mean /= (double)N;
+
+	dmat3 covariance(0.0);
+	for (int i = 0; i < N; i++) {
+		dvec3 d = texels[i] - mean;
+		for (int c = 0; c < 3; c++) {
+			covariance[c] += d[c] * d;
+		}
+	}
+
+	// A few steps of power iteration find the principal axis.
+	dvec3 axis(1.0, 1.0, 1.0);
+	for (int i = 0; i < 8; i++) {
+		dvec3 next = covariance * axis;
+		double len = glm::length(next);
+		if (len < 1.0E-12) {
+			break;
+		}
+		axis = next / len;
+	}
+
+	double lo = 0.0, hi = 0.0;
+	for (int i = 0; i < N; i++) {
+		double t = glm::dot(texels[i] - mean, axis);
+		lo = glm::min(lo, t);
+		hi = glm::max(hi, t);
+	}
+
+	BC1Block block;
+	block.color0 = toRGB565(mean + hi * axis);
+	block.color1 = toRGB565(mean + lo * axis);
+	if (block.color0 < block.color1) {
+		std::swap(block.color0, block.color1);
+	}
+	block.indices = 0;
+	if (block.color0 == block.color1) {
+		return block;
+	}
+
+	color palette[4];
+	for (int p = 0; p < 4; p++) {
+		palette[p] = paletteColor(block, p);
+	}
+	for (int i = 0; i < N; i++) {
+		int best = 0;
+		double bestError = FLT_MAX;
+		for (int p = 0; p < 4; p++) {
+			dvec3 d = texels[i] - palette[p];
+			double error = glm::dot(d, d);
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		block.indices |= (unsigned int)best << (2 * i);
+	}
+	return block;
+}
+
+/**
+ * @fn	void Image::compressBC1(const color* rowMajorTexels)
+ * @brief	Compresses the texels into BC1 blocks and measures the PSNR of the
+ * 			result. Partial blocks on the right and top edges repeat the edge texels.
+ * @param	rowMajorTexels	W * H texels, in the order of the PPM file.
+ */
+
+void Image::compressBC1(const color* rowMajorTexels) {
+	tilesAcross = (W + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	int blocksDown = (H + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	delete[] pixels;
+	pixels = nullptr;
+	blocks.resize(tilesAcross * blocksDown);
+
+	for (int by = 0; by < blocksDown; by++) {
+		for (int bx = 0; bx < tilesAcross; bx++) {
+			color texels[BC1_BLOCK_SIZE * BC1_BLOCK_SIZE];
+			for (int j = 0; j < BC1_BLOCK_SIZE; j++) {
+				for (int i = 0; i < BC1_BLOCK_SIZE; i++) {
+					int x = glm::min(bx * BC1_BLOCK_SIZE + i, W - 1);
+					int y = glm::min(by * BC1_BLOCK_SIZE + j, H - 1);
+					texels[j * BC1_BLOCK_SIZE + i] = rowMajorTexels[y * W + x];
+				}
+			}
+			blocks[by * tilesAcross + bx] = encodeBC1Block(texels);
+		}
+	}
+
+	double sumSquaredError = 0.0;
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			dvec3 d = decodeBC1(x, y) - rowMajorTexels[y * W + x];
+			sumSquaredError += glm::dot(d, d);
+		}
+	}
+	double mse = sumSquaredError / (3.0 * W * H);
+	compressionPSNR = mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : FLT_MAX;
+}
+
+/**
+ * @fn	color Image::decodeBC1(int x, int y) const
+ * @brief	Decodes a single texel of a BC1 image.
+ * @param	x	The column.
+ * @param	y	The row.
+ * @return	The texel's color.
+ */
+
+color Image::decodeBC1(int x, int y) const {
+	const BC1Block& block = blocks[(y / BC1_BLOCK_SIZE) * tilesAcross + x / BC1_BLOCK_SIZE];
+	int texel = (y % BC1_BLOCK_SIZE) * BC1_BLOCK_SIZE + x % BC1_BLOCK_SIZE;
+	return paletteColor(block, (block.indices >> (2 * texel)) & 3);
 }
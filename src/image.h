@@ -12,15 +12,56 @@
 #include "defs.h"
 #include "colorandmaterials.h"
 
- /**
-  * @struct	Image
-  * @brief	Represents a rectangular RGB image.
-  */
+const int TEXEL_TILE_BITS = 3;							//!< log2 of the texel tile size.
+const int TEXEL_TILE_SIZE = 1 << TEXEL_TILE_BITS;		//!< 8x8 texels per tile.
+const int TEXEL_TILE_AREA = TEXEL_TILE_SIZE * TEXEL_TILE_SIZE;
+const int BC1_BLOCK_SIZE = 4;							//!< BC1 compresses 4x4 texels at a time.
+
+/**
+ * @enum	TexelLayout
+ * @brief	The order in which texels are stored in memory. ROW_MAJOR is the
+ * 			order of the PPM file. TILED stores 8x8 tiles, each row-major inside.
+ * 			MORTON stores 8x8 tiles, each in Z-order inside, so that texels
+ * 			that are close in both u and v are close in memory. BC1 compresses
+ * 			each 4x4 block into 8 bytes, which are decoded when sampled.
+ */
+
+enum class TexelLayout { ROW_MAJOR, TILED, MORTON, BC1 };
+
+/**
+ * @struct	BC1Block
+ * @brief	A 4x4 block of texels in BC1 (DXT1) format. Two RGB565 endpoint
+ * 			colors, and a 2 bit palette index for each of the 16 texels.
+ */
+
+struct BC1Block {
+	unsigned short color0;	//!< First endpoint, RGB565.
+	unsigned short color1;	//!< Second endpoint, RGB565.
+	unsigned int indices;	//!< 2 bits per texel, row-major, texel 0 in the low bits.
+};
+
+/**
+ * @struct	Image
+ * @brief	Represents a rectangular RGB image.
+ */
 
 struct Image {
 	int W, H;
 	color* pixels;
-	Image(std::string ppmFileName);
+	Image(std::string ppmFileName, TexelLayout layout = TexelLayout::ROW_MAJOR);
 	~Image() { delete[] pixels; }
 	color getPixelUV(double u, double v) const;
+	color getPixel(int x, int y) const;
+	TexelLayout getLayout() const { return layout; }
+	void setTexels(const color* rowMajorTexels);
+	size_t getTexelMemory() const;
+	double getCompressionPSNR() const { return compressionPSNR; }
+protected:
+	TexelLayout layout;			//!< How pixels is organized.
+	int tilesAcross;			//!< Number of tiles (or BC1 blocks) in one row.
+	vector<BC1Block> blocks;	//!< The texels, when layout is BC1. pixels is then nullptr.
+	double compressionPSNR;		//!< PSNR (dB) of the BC1 texels against the originals.
+	int texelIndex(int x, int y) const;
+	color decodeBC1(int x, int y) const;
+	void compressBC1(const color* rowMajorTexels);
 };
@@ -177,6 +177,53 @@ bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
 	return false;
 }
 
+/**
+ * @fn	double PositionalLight::visibility(const dvec3& intercept, const dvec3& normal,
+ *											const vector<VisibleIShapePtr>& objects, int samples) const
+ * @brief	Estimates how much of the light's disk can be seen from an intercept
+ * 			point, by casting shadow feelers at points spread over the disk. The
+ * 			disk faces the intercept point. The pattern is rotated by a different
+ * 			angle at each point, so too few samples give noise, not bands.
+ * @param	intercept	The position of the intercept.
+ * @param	normal		The normal vector at the intercept point.
+ * @param	objects		The collection of opaque objects in the scene.
+ * @param	samples		Number of shadow feelers.
+ * @return	Fraction of the feelers that reach the light, in [0, 1].
+ */
+
+double PositionalLight::visibility(const dvec3& intercept,
+	const dvec3& normal,
+	const vector<VisibleIShapePtr>& objects,
+	int samples) const {
+	const double GOLDEN_ANGLE = PI * (3.0 - std::sqrt(5.0));
+	dvec3 origin = intercept + EPSILON * normal;
+	dvec3 w = glm::normalize(pos - origin);
+	dvec3 u = glm::normalize(glm::cross(std::abs(w.x) < 0.9 ? X_AXIS : Y_AXIS, w));
+	dvec3 v = glm::cross(w, u);
+	double hash = std::sin(glm::dot(intercept, dvec3(12.9898, 78.233, 37.719))) * 43758.5453;
+	double rotation = 2.0 * PI * (hash - std::floor(hash));
+
+	int visible = 0;
+	for (int i = 0; i < samples; i++) {
+		// Vogel's spiral spreads the samples evenly over the disk.
+		double r = radius * std::sqrt((i + 0.5) / samples);
+		double theta = i * GOLDEN_ANGLE + rotation;
+		dvec3 samplePos = pos + r * (std::cos(theta) * u + std::sin(theta) * v);
+		Ray shadowFeeler(origin, samplePos - origin);
+		double lightDist = glm::length(samplePos - origin);
+		bool blocked = false;
+		for (size_t j = 0; j < objects.size() && !blocked; j++) {
+			OpaqueHitRecord hit;
+			objects[j]->findClosestIntersection(shadowFeeler, hit);
+			blocked = hit.t < lightDist;
+		}
+		if (!blocked) {
+			visible++;
+		}
+	}
+	return (double)visible / samples;
+}
+
 /**
 * @fn	Ray PositionalLight::getShadowFeeler(const dvec3& interceptWorldCoords, const dvec3& normal, const Frame &eyeFrame) const
 * @brief	Returns the shadow feeler for this light.
@@ -79,9 +79,10 @@ struct PositionalLight : public LightSource {
 	bool attenuationIsTurnedOn;	//!< true if attenuation is active.
 	bool isTiedToWorld;			//!< true if the position is in world (or eye) coordinates.
 	LightATParams atParams;
+	double radius;				//!< Radius of the light's disk, for soft shadows.
 
 	PositionalLight(const dvec3& position, const color& C = white)
-		: LightSource(C), pos(position), atParams(0.0, 1.0, 0.0) {
+		: LightSource(C), pos(position), atParams(0.0, 1.0, 0.0), radius(0.0) {
 		attenuationIsTurnedOn = false;
 		isTiedToWorld = true;
 	}
@@ -98,6 +99,10 @@ struct PositionalLight : public LightSource {
 		const dvec3& normal, 
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const;
+	double visibility(const dvec3& intercept,
+		const dvec3& normal,
+		const vector<VisibleIShapePtr>& objects,
+		int samples) const;
 };
 
 /**
@@ -9,6 +9,12 @@
 
 #include <cmath>
 #include "rasterization.h"
+#include "threadpool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define RASTERIZATION_SSE2
+#endif
 
  /**
  * @fn	template <class T> T barycentricWeighting(double w1, double w2, double w3,
@@ -74,9 +80,8 @@ static void drawHorizontalLine(FrameBuffer& fb, int y, int left, int right, cons
 	}
 	left = left < 0 ? 0 : left;
 	right = right >= W ? W - 1 : right;
-	for (int x = left; x <= right; x++) {
-		if (inRectangle((double)x, (double)y, 0.0, 0.0, W - 1.0, H - 1.0))
-			fb.setColor(x, y, rgb);
+	if (y >= 0 && y < H) {
+		fb.fillColorSpan(left, y, right - left + 1, rgb);
 	}
 }
 
@@ -222,58 +227,90 @@ void drawAxisOnWindow(FrameBuffer& fb) {
 }
 
 /**
- * @fn	double cheapNonPerspectiveCorrectInterpolationForLines(const dvec2 &start, const dvec2 &end,
- *																const dvec2 &online)
- * @brief	Cheap non perspective correct interpolation for lines
- * @param	start 	The starting vertex.
- * @param	end   	The ending vertex
- * @param	online	The 2D point to interpolate.
- * @return	Interpolated value.
+ * @struct	LineSetup
+ * @brief	What a line works out once, so that each pixel costs a few
+ * 			multiply-adds. The attributes are interpolated by a parameter t
+ * 			that runs from 0 at v0 to 1 at v1 along the major axis, and that
+ * 			the line routines step by a constant each pixel. Depth is linear
+ * 			in t. World position and normal are linear in t only after they
+ * 			are divided by w, so they are interpolated that way, with 1/w, and
+ * 			are perspective correct.
+ */
+
+struct LineSetup {
+	double z, dz;						//!< Depth at v0, and its change from v0 to v1
+	double invW, dInvW;					//!< 1/w at v0, and its change
+	dvec3 worldPos, dWorldPos;			//!< World position / w at v0, and its change
+	dvec3 normal, dNormal;				//!< Normal / w at v0, and its change
+	LineSetup(const VertexData& v0, const VertexData& v1);
+	void fragmentAt(double t, double x, double y, Fragment& fragment) const;
+};
+
+/**
+ * @fn	LineSetup::LineSetup(const VertexData& v0, const VertexData& v1)
+ * @brief	Sets up the attributes of a line.
+ * @param	v0	The first endpoint.
+ * @param	v1	The second endpoint.
+ */
+
+LineSetup::LineSetup(const VertexData& v0, const VertexData& v1) {
+	z = v0.pos.z;
+	dz = v1.pos.z - v0.pos.z;
+	invW = v0.pos.w;
+	dInvW = v1.pos.w - v0.pos.w;
+	worldPos = v0.worldPos * v0.pos.w;
+	dWorldPos = v1.worldPos * v1.pos.w - worldPos;
+	normal = v0.normal * v0.pos.w;
+	dNormal = v1.normal * v1.pos.w - normal;
+}
+
+/**
+ * @fn	void LineSetup::fragmentAt(double t, double x, double y, Fragment& fragment) const
+ * @brief	Interpolates the line's attributes at a pixel.
+ * @param 	  	t	   	The pixel's parameter along the line.
+ * @param 	  	x	   	The pixel's column.
+ * @param 	  	y	   	The pixel's row.
+ * @param [out]	fragment	The fragment. Its material and palette index are left alone.
  */
 
-static double cheapNonPerspectiveCorrectInterpolationForLines(const dvec2& start, const dvec2& end,
-	const dvec2& online) {
-	return glm::length(online - start) / glm::length(end - start);
+void LineSetup::fragmentAt(double t, double x, double y, Fragment& fragment) const {
+	double w = 1.0 / (invW + t * dInvW);
+	fragment.worldPos = (worldPos + t * dWorldPos) * w;
+	fragment.worldNormal = (normal + t * dNormal) * w;
+	fragment.windowPos = dvec3(x, y, z + t * dz);
 }
 
 /**
  * @fn	void drawVerticalLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *									const vector<LightSourcePtr> &lights,
- *									VertexData v0, VertexData v1, const dmat4 &viewingMatrix)
+ *									VertexData v0, VertexData v1, const Material &material,
+ *									const Frame &eyeFrame)
  * @brief	Draw vertical line
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
+ * @param 		  	material	 	The line's material.
  * @param 		  	eyeFrame	    The camera's frame.
  */
 
 static void drawVerticalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
+	const Material& material, const Frame& eyeFrame) {
 	if (v1.pos.y < v0.pos.y) {
 		std::swap(v0, v1);
 	}
 
-	double zDifference = v1.pos.z - v0.pos.z;
-
-	for (double y = v0.pos.y; y < v1.pos.y; y++) {
-		// Interpolate vertex attributes
-		double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-			v1.pos.xy(),
-			dvec2(v0.pos.x, y));
-
-		Fragment fragment;
-
-		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		double oneMinusW = 1.0 - weight;
-		fragment.material = weightedAverage(oneMinusW, v0.material, weight, v1.material);
-		double z = weightedAverage(oneMinusW, v0.pos.z, weight, v1.pos.z);
-		fragment.worldNormal = weightedAverage(oneMinusW, v0.normal, weight, v1.normal);
-		fragment.worldPos = weightedAverage(oneMinusW, v0.worldPos, weight, v1.worldPos);
-		fragment.windowPos = dvec3(v0.pos.x, y, z);
+	const LineSetup line(v0, v1);
+	const double dt = 1.0 / (v1.pos.y - v0.pos.y);
+	Fragment fragment;
+	fragment.material = &material;
+	fragment.materialId = frameBuffer.getMaterialId(&material);
 
+	double t = 0.0;
+	for (double y = v0.pos.y; y < v1.pos.y; y++, t += dt) {
+		line.fragmentAt(t, v0.pos.x, y, fragment);
 		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 	}
 }
@@ -281,82 +318,73 @@ static void drawVerticalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 /**
  * @fn	static void drawHorizontalLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *										const vector<LightSourcePtr> &lights,
- *										VertexData v0, VertexData v1, const Frame &eyeFrame)
+ *										VertexData v0, VertexData v1, const Material &material,
+ *										const Frame &eyeFrame)
  * @brief	Draw horizontal line
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
+ * @param 		  	material	 	The line's material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
 static void drawHorizontalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
+	const Material& material, const Frame& eyeFrame) {
 	if (v1.pos.x < v0.pos.x) {
 		std::swap(v0, v1);
 	}
 
-	for (double x = v0.pos.x; x < v1.pos.x; x++) {
-		// Interpolate vertex attributes
-		double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-			v1.pos.xy(),
-			dvec2(x, v0.pos.y));
-
-		Fragment fragment;
-
-		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-		double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-		fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-		fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-		fragment.windowPos = dvec3(x, v1.pos.y, z);
+	const LineSetup line(v0, v1);
+	const double dt = 1.0 / (v1.pos.x - v0.pos.x);
+	Fragment fragment;
+	fragment.material = &material;
+	fragment.materialId = frameBuffer.getMaterialId(&material);
 
+	double t = 0.0;
+	for (double x = v0.pos.x; x < v1.pos.x; x++, t += dt) {
+		line.fragmentAt(t, x, v1.pos.y, fragment);
 		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 	}
 }
 
 /**
- * @fn	static void midPointLine(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const dmat4 &viewingMatrix)
- * @brief	Middle point line
+ * @fn	static void midPointLine(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const Material &material, const Frame &eyeFrame)
+ * @brief	Middle point line. The parameter along the line is stepped with
+ * 			the major axis.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
+ * @param 		  	material	 	The line's material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
 static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
+	const Material& material, const Frame& eyeFrame) {
 	if (v1.pos.x < v0.pos.x) {
 		std::swap(v0, v1);
 	}
 
+	const LineSetup line(v0, v1);
+	Fragment fragment;
+	fragment.material = &material;
+	fragment.materialId = frameBuffer.getMaterialId(&material);
+
 	// Calculate slope of the line
 	double m = (v1.pos.y - v0.pos.y) / (v1.pos.x - v0.pos.x);
 
 	if (m > 0 && m < 1.0) { // For slope in (0,1] More "run" than "rise"
+		const double dt = 1.0 / (v1.pos.x - v0.pos.x);
 		double y = v0.pos.y;
+		double t = 0.0;
 
-		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
+		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0, t += dt) {
+			line.fragmentAt(t, x, y, fragment);
 			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 
 			// Evaluate the implicit equation for the line to determine if
@@ -370,24 +398,12 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			}
 		}
 	} else if (m > 1) { // For slope in (1,infinity] More "run" than "rise"
+		const double dt = 1.0 / (v1.pos.y - v0.pos.y);
 		double x = v0.pos.x;
+		double t = 0.0;
 
-		for (double y = v0.pos.y; y < v1.pos.y; y += 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
+		for (double y = v0.pos.y; y < v1.pos.y; y += 1.0, t += dt) {
+			line.fragmentAt(t, x, y, fragment);
 			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 
 			// Evaluate the implicit equation for the line to determine if
@@ -401,24 +417,12 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			}
 		}
 	} else if (m >= -1.0 && m < 0) { // For slope in [-1,0) More "run" than "rise"
+		const double dt = 1.0 / (v1.pos.x - v0.pos.x);
 		double y = v0.pos.y;
-		double x = v0.pos.x;
-
-		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0) {
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
+		double t = 0.0;
 
+		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0, t += dt) {
+			line.fragmentAt(t, x, y, fragment);
 			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 
 			// Evaluate the implicit equation for the line to determine if
@@ -432,24 +436,12 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 			}
 		}
 	} else if (m < -1) { // For slope in [-infinity,-1) More "run" than "rise"
+		const double dt = 1.0 / (v0.pos.y - v1.pos.y);
 		double x = v0.pos.x;
+		double t = 0.0;
 
-		for (double y = v0.pos.y; y > v1.pos.y; y -= 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
+		for (double y = v0.pos.y; y > v1.pos.y; y -= 1.0, t += dt) {
+			line.fragmentAt(t, x, y, fragment);
 			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 
 			// Evaluate the implicit equation for the line to determine if
@@ -468,47 +460,51 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 /**
  * @fn	void drawLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *						const vector<LightSourcePtr> &lights,
- *						const VertexData &v0, const VertexData &v1, const Frame &eyeFrame)
+ *						const VertexData &v0, const VertexData &v1,
+ *						const Material &material, const Frame &eyeFrame)
  * @brief	Draw line
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
+ * @param 		  	material	 	The line's material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
 void drawLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1,
-	const Frame& eyeFrame) {
+	const Material& material, const Frame& eyeFrame) {
 	if (v0.pos.x == v1.pos.x) {
-		drawVerticalLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
+		drawVerticalLine(frameBuffer, eyePos, lights, v0, v1, material, eyeFrame);
 	} else if (v0.pos.y == v1.pos.y) {
-		drawHorizontalLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
+		drawHorizontalLine(frameBuffer, eyePos, lights, v0, v1, material, eyeFrame);
 	} else {
-		midPointLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
+		midPointLine(frameBuffer, eyePos, lights, v0, v1, material, eyeFrame);
 	}
 }
 
 /**
  * @fn	void drawManyLines(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *							const vector<LightSourcePtr> &lights,
- *							const vector<VertexData> &vertices, const Frame &eyeFrame)
+ *							const vector<VertexData> &vertices, const Material &material,
+ *							const Frame &eyeFrame)
  * @brief	Draw many lines
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	vertices	 	Vector of vertice-pairs.
+ * @param 		  	material	 	The lines' material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
 void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& vertices,
-	const Frame& eyeFrame) {
+	const Material& material, const Frame& eyeFrame) {
 	for (unsigned int i = 0; (i + 1) < vertices.size(); i += 2) {
-		drawLine(frameBuffer, eyePos, lights, vertices[i], vertices[i + 1], eyeFrame);
+		drawLine(frameBuffer, eyePos, lights, vertices[i], vertices[i + 1], material, eyeFrame);
 	}
 }
 
@@ -516,7 +512,7 @@ void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
  * @fn	void drawWireFrameTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *									const vector<LightSourcePtr> &lights,
  *									const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									const Frame &eyeFrame)
+ *									const Material &material, const Frame &eyeFrame)
  * @brief	Draw wire frame triangle.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
@@ -524,6 +520,7 @@ void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
  * @param 		  	v0			 	First VertexData.
  * @param 		  	v1			 	Second VertexData.
  * @param 		  	v2			 	Third VertexData.
+ * @param 		  	material	 	The triangle's material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
@@ -533,21 +530,24 @@ void drawWireFrameTriangle(FrameBuffer& frameBuffer,
 	const VertexData& v0,
 	const VertexData& v1,
 	const VertexData& v2,
+	const Material& material,
 	const Frame& eyeFrame) {
-	drawLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
-	drawLine(frameBuffer, eyePos, lights, v1, v2, eyeFrame);
-	drawLine(frameBuffer, eyePos, lights, v2, v0, eyeFrame);
+	drawLine(frameBuffer, eyePos, lights, v0, v1, material, eyeFrame);
+	drawLine(frameBuffer, eyePos, lights, v1, v2, material, eyeFrame);
+	drawLine(frameBuffer, eyePos, lights, v2, v0, material, eyeFrame);
 }
 
 /**
  * @fn	void drawManyWireFrameTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *										const vector<LightSourcePtr> &lights,
- *										const vector<VertexData> &vertices, const Frame &eyeFrame)
+ *										const vector<VertexData> &vertices, const Material &material,
+ *										const Frame &eyeFrame)
  * @brief	Draw many wire frame triangles
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	vertices	 	The vector of vertex-triplets.
+ * @param 		  	material	 	The triangles' material.
  * @param 		  	eyeFrame		The camera frame.
  */
 
@@ -555,149 +555,529 @@ void drawManyWireFrameTriangles(FrameBuffer& frameBuffer,
 	const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& vertices,
+	const Material& material,
 	const Frame& eyeFrame) {
 	for (unsigned int i = 0; (i + 2) < vertices.size(); i += 3) {
 		drawWireFrameTriangle(frameBuffer, eyePos, lights,
-			vertices[i], vertices[i + 1], vertices[i + 2], eyeFrame);
+			vertices[i], vertices[i + 1], vertices[i + 2], material, eyeFrame);
 	}
 }
 
 /**
- * @fn	static inline double f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, double x, double y)
- * @brief	Computes f01. Implicit equation for the line between v0 and v1.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f01.
+ * @struct	EdgeFunction
+ * @brief	One of a triangle's barycentric coordinates, as a linear function of
+ * 			the window position: a * x + b * y + c. It is the implicit equation of
+ * 			the opposite edge, divided by its value at the opposite vertex, so it
+ * 			is 1 there, 0 on the edge and negative outside the triangle.
  */
 
-static inline double f01(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v0.pos.y - v1.pos.y) * x + (v1.pos.x - v0.pos.x) * y +
-		(v0.pos.x * v1.pos.y) - (v1.pos.x * v0.pos.y);
+struct EdgeFunction {
+	double a, b, c;								//!< Coefficients
+	bool ownsTies;								//!< True if pixels exactly on the edge are drawn
+	double groupOffsets[RASTER_GROUP_SIZE];		//!< a * k, for the k'th pixel of a group
+	double at(double x, double y) const { return a * x + b * y + c; }
+	bool covers(double value) const { return ownsTies ? value >= 0 : value > 0; }
+};
 
+/**
+ * @fn	static bool setupEdge(const dvec4& p0, const dvec4& p1, const dvec4& p2, EdgeFunction& edge)
+ * @brief	Sets up the barycentric coordinate of p0, from the implicit equation
+ * 			of the line through p1 and p2. A pixel exactly on an edge shared by
+ * 			two triangles is drawn by just one of them: the one on the same side
+ * 			of the edge as the point (-1, -1).
+ * @see		Fundamentals of Computer Graphics, 4th ed., section 8.1.2.
+ * @param 	  	p0  	The vertex opposite the edge.
+ * @param 	  	p1  	An end of the edge.
+ * @param 	  	p2  	The other end of the edge.
+ * @param [out]	edge	The edge function.
+ * @return	False if the triangle is degenerate.
+ */
+
+static bool setupEdge(const dvec4& p0, const dvec4& p1, const dvec4& p2, EdgeFunction& edge) {
+	edge.a = p1.y - p2.y;
+	edge.b = p2.x - p1.x;
+	edge.c = p1.x * p2.y - p2.x * p1.y;
+	const double atVertex = edge.at(p0.x, p0.y);
+	if (atVertex == 0.0 || !std::isfinite(atVertex)) {
+		return false;
+	}
+	edge.ownsTies = atVertex * edge.at(-1.0, -1.0) > 0;
+	edge.a /= atVertex;
+	edge.b /= atVertex;
+	edge.c /= atVertex;
+	for (int k = 0; k < RASTER_GROUP_SIZE; k++) {
+		edge.groupOffsets[k] = k * edge.a;
+	}
+	return true;
 }
 
 /**
- * @fn	static inline double f12(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f12. Implicit equation for the line between v1 and v2.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f12.
+ * @fn	static inline int coverageMask(const EdgeFunction edges[3], const double base[3])
+ * @brief	Tests a group of RASTER_GROUP_SIZE consecutive pixels of a row against
+ * 			a triangle.
+ * @param	edges	The triangle's edge functions.
+ * @param	base 	The value of each edge function at the group's first pixel.
+ * @return	Bit k is set if the k'th pixel of the group is in the triangle.
+ */
+
+static inline int coverageMask(const EdgeFunction edges[3], const double base[3]) {
+#ifdef RASTERIZATION_SSE2
+	const __m128d zero = _mm_setzero_pd();
+	__m128d inLo = _mm_cmpeq_pd(zero, zero);
+	__m128d inHi = inLo;
+	for (int e = 0; e < 3; e++) {
+		const __m128d b = _mm_set1_pd(base[e]);
+		const __m128d lo = _mm_add_pd(b, _mm_loadu_pd(edges[e].groupOffsets));
+		const __m128d hi = _mm_add_pd(b, _mm_loadu_pd(edges[e].groupOffsets + 2));
+		if (edges[e].ownsTies) {
+			inLo = _mm_and_pd(inLo, _mm_cmpge_pd(lo, zero));
+			inHi = _mm_and_pd(inHi, _mm_cmpge_pd(hi, zero));
+		} else {
+			inLo = _mm_and_pd(inLo, _mm_cmpgt_pd(lo, zero));
+			inHi = _mm_and_pd(inHi, _mm_cmpgt_pd(hi, zero));
+		}
+	}
+	return _mm_movemask_pd(inLo) | (_mm_movemask_pd(inHi) << 2);
+#else
+	int mask = 0;
+	for (int k = 0; k < RASTER_GROUP_SIZE; k++) {
+		if (edges[0].covers(base[0] + edges[0].groupOffsets[k]) &&
+			edges[1].covers(base[1] + edges[1].groupOffsets[k]) &&
+			edges[2].covers(base[2] + edges[2].groupOffsets[k])) {
+			mask |= 1 << k;
+		}
+	}
+	return mask;
+#endif
+}
+
+/**
+ * @enum	BlockCoverage
+ * @brief	How much of a block of pixels a triangle covers.
+ */
+
+enum class BlockCoverage { OUTSIDE, PARTIAL, INSIDE, HIDDEN };
+
+/**
+ * @fn	static BlockCoverage classifyBlock(const EdgeFunction edges[3], int x0, int y0, int x1, int y1)
+ * @brief	Classifies a block of pixels against a triangle. An edge function is
+ * 			linear, so its least and greatest values over the block are at two of
+ * 			its corners. The test is conservative: blocks within RASTER_BLOCK_MARGIN
+ * 			of an edge are partial.
+ * @param	edges	The triangle's edge functions.
+ * @param	x0   	Left column of the block.
+ * @param	y0   	Bottom row of the block.
+ * @param	x1   	Right column of the block.
+ * @param	y1   	Top row of the block.
+ * @return	Whether the block is outside, inside or partly inside the triangle.
+ */
+
+static BlockCoverage classifyBlock(const EdgeFunction edges[3], int x0, int y0, int x1, int y1) {
+	BlockCoverage coverage = BlockCoverage::INSIDE;
+	for (int e = 0; e < 3; e++) {
+		const EdgeFunction& edge = edges[e];
+		double least = edge.at(edge.a > 0 ? x0 : x1, edge.b > 0 ? y0 : y1);
+		double greatest = edge.at(edge.a > 0 ? x1 : x0, edge.b > 0 ? y1 : y0);
+		if (greatest < -RASTER_BLOCK_MARGIN) {
+			return BlockCoverage::OUTSIDE;
+		}
+		if (least <= RASTER_BLOCK_MARGIN) {
+			coverage = BlockCoverage::PARTIAL;
+		}
+	}
+	return coverage;
+}
+
+/**
+ * @struct	AttributePlane
+ * @brief	A vertex attribute as a linear function of the window position:
+ * 			a * x + b * y + c.
+ * @tparam	T	Type of the attribute.
  */
 
-static inline double f12(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v1.pos.y - v2.pos.y) * x + (v2.pos.x - v1.pos.x) * y +
-		(v1.pos.x * v2.pos.y) - (v2.pos.x * v1.pos.y);
+template <class T>
+struct AttributePlane {
+	T a, b, c;		//!< Coefficients
+	void setup(const EdgeFunction edges[3], const T& i0, const T& i1, const T& i2);
+	T atRow(double y) const { return b * y + c; }
+};
+
+/**
+ * @fn	template <class T> void AttributePlane<T>::setup(const EdgeFunction edges[3],
+ *															const T& i0, const T& i1, const T& i2)
+ * @brief	Sets up the plane through a triangle's three values. The edge
+ * 			functions are the barycentric coordinates, so the plane is their
+ * 			weighting of the values.
+ * @tparam	T	Type of the attribute.
+ * @param	edges	The triangle's edge functions.
+ * @param	i0   	The value at v0.
+ * @param	i1   	The value at v1.
+ * @param	i2   	The value at v2.
+ */
 
+template <class T>
+void AttributePlane<T>::setup(const EdgeFunction edges[3], const T& i0, const T& i1, const T& i2) {
+	a = barycentricWeighting(edges[0].a, edges[1].a, edges[2].a, i0, i1, i2);
+	b = barycentricWeighting(edges[0].b, edges[1].b, edges[2].b, i0, i1, i2);
+	c = barycentricWeighting(edges[0].c, edges[1].c, edges[2].c, i0, i1, i2);
 }
 
 /**
- * @fn	static inline double f20(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f20. Implicit equation for the line between v2 and v0.
- * @see		*** page in textbook.
+ * @struct	TriangleSetup
+ * @brief	What the rasterizer works out once for each triangle. Depth is
+ * 			linear in window coordinates. World position and normal are only
+ * 			linear once divided by w, so their planes are of the attribute
+ * 			times 1/w, and a pixel's value is divided by the plane of 1/w, which
+ * 			makes them perspective correct.
+ */
+
+struct TriangleSetup {
+	EdgeFunction edges[3];			//!< alpha, beta and gamma
+	int xMin, xMax, yMin, yMax;		//!< The bounding box, within the window
+	double zMin;					//!< Least depth of the vertices
+	dvec3 zPlane;					//!< Depth is zPlane.x * x + zPlane.y * y + zPlane.z
+	AttributePlane<double> invW;			//!< 1/w
+	AttributePlane<dvec3> worldPos;			//!< World position / w
+	AttributePlane<dvec3> normal;			//!< Normal / w
+	int materialId;					//!< Palette index of the material, when shading deferred
+	bool setup(const VertexData& v0, const VertexData& v1, const VertexData& v2, int W, int H);
+	bool isHidden(FrameBuffer& frameBuffer, int x0, int y0, int x1, int y1) const;
+};
+
+/**
+ * @fn	bool TriangleSetup::setup(const VertexData& v0, const VertexData& v1, const VertexData& v2,
+ *								int W, int H)
+ * @brief	Sets up the edge functions, bounding box and attribute planes of a
+ * 			triangle.
  * @param	v0	v0.
  * @param	v1	v1.
  * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f02.
+ * @param	W 	Width of the window.
+ * @param	H 	Height of the window.
+ * @return	False if the triangle is degenerate or outside the window.
+ */
+
+bool TriangleSetup::setup(const VertexData& v0, const VertexData& v1, const VertexData& v2, int W, int H) {
+	if (!setupEdge(v0.pos, v1.pos, v2.pos, edges[0]) ||
+		!setupEdge(v1.pos, v2.pos, v0.pos, edges[1]) ||
+		!setupEdge(v2.pos, v0.pos, v1.pos, edges[2])) {
+		return false;
+	}
+
+	// Find minimimum and maximum x and y limits for the triangle, within the window
+	xMin = (int)glm::max(glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x)), 0.0);
+	xMax = (int)glm::min(glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x)), W - 1.0);
+	yMin = (int)glm::max(glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y)), 0.0);
+	yMax = (int)glm::min(glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y)), H - 1.0);
+
+	zMin = min(v0.pos.z, v1.pos.z, v2.pos.z);
+	zPlane = v0.pos.z * dvec3(edges[0].a, edges[0].b, edges[0].c) +
+		v1.pos.z * dvec3(edges[1].a, edges[1].b, edges[1].c) +
+		v2.pos.z * dvec3(edges[2].a, edges[2].b, edges[2].c);
+	invW.setup(edges, v0.pos.w, v1.pos.w, v2.pos.w);
+	worldPos.setup(edges, v0.worldPos * v0.pos.w, v1.worldPos * v1.pos.w, v2.worldPos * v2.pos.w);
+	normal.setup(edges, v0.normal * v0.pos.w, v1.normal * v1.pos.w, v2.normal * v2.pos.w);
+	return xMin <= xMax && yMin <= yMax;
+}
+
+/**
+ * @fn	bool TriangleSetup::isHidden(FrameBuffer& frameBuffer, int x0, int y0, int x1, int y1) const
+ * @brief	Hierarchical Z test. The triangle's depth is linear, so its least
+ * 			value over a rectangle is at one of the corners, and it is never
+ * 			less than zMin. If that is behind the greatest depth the
+ * 			framebuffer's tiles hold there, the triangle cannot pass the depth
+ * 			test anywhere in the rectangle.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	x0		   	Left column of the rectangle.
+ * @param 		  	y0		   	Bottom row of the rectangle.
+ * @param 		  	x1		   	Right column of the rectangle.
+ * @param 		  	y1		   	Top row of the rectangle.
+ * @return	True if the triangle is hidden in the rectangle.
+ */
+
+bool TriangleSetup::isHidden(FrameBuffer& frameBuffer, int x0, int y0, int x1, int y1) const {
+	if (!FragmentOps::performDepthTest) {
+		return false;
+	}
+	double nearest = zPlane.x * (zPlane.x > 0 ? x0 : x1) + zPlane.y * (zPlane.y > 0 ? y0 : y1) + zPlane.z;
+	double minDepth, maxDepth;
+	frameBuffer.getDepthBounds(x0, y0, x1, y1, minDepth, maxDepth);
+	return glm::max(nearest, zMin) - RASTER_DEPTH_MARGIN >= maxDepth;
+}
+
+/**
+ * @fn	static bool rasterizeRowSpan(const TriangleSetup& triangle, const Material& material,
+ *									int y, int x0, int x1, bool inside,
+ *									vector<Fragment>& rowFragments)
+ * @brief	Makes the fragments of part of a row of a triangle. The attribute
+ * 			planes are evaluated at the row once, and then each pixel costs a
+ * 			multiply-add per attribute and one division. The whole triangle has
+ * 			one material, so it is not interpolated.
+ * @param 		  	triangle  	The triangle's setup.
+ * @param 		  	material  	The triangle's material.
+ * @param 		  	y		  	The row.
+ * @param 		  	x0		  	The first pixel of the part.
+ * @param 		  	x1		  	The last pixel of the part.
+ * @param 		  	inside	  	True if every pixel of the part is known to be in the
+ * 								triangle, so none need to be tested.
+ * @param [in,out]	rowFragments	The row's fragments so far, left to right.
+ * @return	True if the triangle's span of the row has ended, so the rest of the
+ * 			row can be skipped.
  */
 
-static inline double f20(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v2.pos.y - v0.pos.y) * x + (v0.pos.x - v2.pos.x) * y +
-		(v2.pos.x * v0.pos.y) - (v0.pos.x * v2.pos.y);
+static bool rasterizeRowSpan(const TriangleSetup& triangle, const Material& material,
+	int y, int x0, int x1, bool inside,
+	vector<Fragment>& rowFragments) {
+	const EdgeFunction* edges = triangle.edges;
+	// Groups start at multiples of RASTER_GROUP_SIZE, and each group's edge
+	// values are computed afresh, so a pixel's barycentric coordinates do not
+	// depend on where its span starts. Likewise, the attributes are evaluated
+	// at each pixel rather than accumulated.
+	const double rowStart[3] = { edges[0].at(0, y), edges[1].at(0, y), edges[2].at(0, y) };
+	const double rowZ = triangle.zPlane.y * y + triangle.zPlane.z;
+	const double rowInvW = triangle.invW.atRow(y);
+	const dvec3 rowWorldPos = triangle.worldPos.atRow(y);
+	const dvec3 rowNormal = triangle.normal.atRow(y);
+	for (int x = x0 & ~(RASTER_GROUP_SIZE - 1); x <= x1; x += RASTER_GROUP_SIZE) {
+		const double base[3] = { rowStart[0] + edges[0].a * x, rowStart[1] + edges[1].a * x,
+			rowStart[2] + edges[2].a * x };
+		int mask = inside ? (1 << RASTER_GROUP_SIZE) - 1 : coverageMask(edges, base);
+		if (x < x0) {
+			mask &= ~((1 << (x0 - x)) - 1);
+		}
+		if (x1 - x + 1 < RASTER_GROUP_SIZE) {
+			mask &= (1 << (x1 - x + 1)) - 1;
+		}
+		if (mask == 0 && !rowFragments.empty()) {
+			return true;
+		}
+		for (int k = 0; mask != 0; k++, mask >>= 1) {
+			if ((mask & 1) == 0) {
+				continue;
+			}
+			const double px = x + k;
+			const double w = 1.0 / (triangle.invW.a * px + rowInvW);
+			Fragment fragment;
+			fragment.material = &material;
+			fragment.materialId = triangle.materialId;
+			fragment.worldNormal = (triangle.normal.a * px + rowNormal) * w;
+			fragment.worldPos = (triangle.worldPos.a * px + rowWorldPos) * w;
+			fragment.windowPos = dvec3(px, y, triangle.zPlane.x * px + rowZ);
+			rowFragments.push_back(fragment);
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	static void rasterizeTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
+ *									const vector<LightSourcePtr>& lights,
+ *									const Material& material, const TriangleSetup& triangle,
+ *									int clipX0, int clipY0, int clipX1, int clipY1,
+ *									const Frame& eyeFrame)
+ * @brief	Draws the part of a set up triangle that is inside a rectangle. Only
+ * 			pixels in the rectangle are written.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	eyePos	   	Eye position.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	material   	The triangle's material.
+ * @param 		  	triangle   	The triangle's setup.
+ * @param 		  	clipX0	   	Left column of the rectangle.
+ * @param 		  	clipY0	   	Bottom row of the rectangle.
+ * @param 		  	clipX1	   	Right column of the rectangle.
+ * @param 		  	clipY1	   	Top row of the rectangle.
+ * @param 		  	eyeFrame   	The camera's frame.
+ */
+
+static void rasterizeTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const Material& material, const TriangleSetup& triangle,
+	int clipX0, int clipY0, int clipX1, int clipY1,
+	const Frame& eyeFrame) {
+	const EdgeFunction* edges = triangle.edges;
+	const int xMin = glm::max(triangle.xMin, clipX0);
+	const int xMax = glm::min(triangle.xMax, clipX1);
+	const int yMin = glm::max(triangle.yMin, clipY0);
+	const int yMax = glm::min(triangle.yMax, clipY1);
+	if (xMin > xMax || yMin > yMax || triangle.isHidden(frameBuffer, xMin, yMin, xMax, yMax)) {
+		return;
+	}
+
+	// The pixels of a row that are inside the triangle are consecutive, so
+	// they are gathered and handed to the fragment stage as one span. The
+	// buffers are kept from one triangle to the next, so they rarely grow.
+	static thread_local vector<Fragment> rowFragments;
+	static thread_local vector<BlockCoverage> strip;
+	rowFragments.clear();
+	if (xMax - xMin < RASTER_HIERARCHICAL_SIZE || yMax - yMin < RASTER_HIERARCHICAL_SIZE) {
+		for (int y = yMin; y <= yMax; y++) {
+			rasterizeRowSpan(triangle, material, y, xMin, xMax, false, rowFragments);
+			FragmentOps::processFragmentSpan(frameBuffer, eyePos, lights, rowFragments, eyeFrame);
+			rowFragments.clear();
+		}
+		return;
+	}
+
+	// Blocks are aligned with the window, and so with the framebuffer's tiles.
+	const int bxMin = xMin & ~(RASTER_BLOCK_SIZE - 1);
+	strip.resize((xMax - bxMin) / RASTER_BLOCK_SIZE + 1);
+	for (int by = yMin & ~(RASTER_BLOCK_SIZE - 1); by <= yMax; by += RASTER_BLOCK_SIZE) {
+		const int y0 = glm::max(by, yMin);
+		const int y1 = glm::min(by + RASTER_BLOCK_SIZE - 1, yMax);
+		for (size_t b = 0; b < strip.size(); b++) {
+			const int bx = bxMin + (int)b * RASTER_BLOCK_SIZE;
+			strip[b] = classifyBlock(edges, glm::max(bx, xMin), y0,
+				glm::min(bx + RASTER_BLOCK_SIZE - 1, xMax), y1);
+			if (strip[b] != BlockCoverage::OUTSIDE && triangle.isHidden(frameBuffer,
+				glm::max(bx, xMin), y0, glm::min(bx + RASTER_BLOCK_SIZE - 1, xMax), y1)) {
+				strip[b] = BlockCoverage::HIDDEN;
+			}
+		}
+		for (int y = y0; y <= y1; y++) {
+			for (size_t b = 0; b < strip.size(); b++) {
+				if (strip[b] == BlockCoverage::OUTSIDE) {
+					if (!rowFragments.empty()) {
+						break;
+					}
+					continue;
+				}
+				if (strip[b] == BlockCoverage::HIDDEN) {
+					// The span is split around blocks that are hidden.
+					FragmentOps::processFragmentSpan(frameBuffer, eyePos, lights, rowFragments, eyeFrame);
+					rowFragments.clear();
+					continue;
+				}
+				const int bx = bxMin + (int)b * RASTER_BLOCK_SIZE;
+				if (rasterizeRowSpan(triangle, material, y, glm::max(bx, xMin),
+					glm::min(bx + RASTER_BLOCK_SIZE - 1, xMax),
+					strip[b] == BlockCoverage::INSIDE, rowFragments)) {
+					break;
+				}
+			}
+			FragmentOps::processFragmentSpan(frameBuffer, eyePos, lights, rowFragments, eyeFrame);
+			rowFragments.clear();
+		}
+	}
 }
 
 /**
  * @fn	void drawFilledTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *								const vector<LightSourcePtr> &lights,
  *								const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *								const dmat4 &viewingMatrix)
- * @brief	Draw filled triangle.
+ *								const Material &material, const Frame &eyeFrame)
+ * @brief	Draw filled triangle. The edge functions are set up once, and stepped
+ * 			across each row of the part of the bounding box inside the window,
+ * 			RASTER_GROUP_SIZE pixels at a time. If the box is large, it is
+ * 			walked in strips of RASTER_BLOCK_SIZE x RASTER_BLOCK_SIZE blocks
+ * 			instead. Blocks outside the triangle are skipped, and the pixels of
+ * 			blocks inside it are not tested. When depth testing is on, the
+ * 			triangle, and then each block, is skipped if it is behind what the
+ * 			depth buffer already holds there. World position and normal are
+ * 			interpolated perspective correctly.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	v0.
  * @param 		  	v1			 	v1.
  * @param 		  	v2			 	v2.
+ * @param 		  	material	 	The triangle's material.
  * @param               eyeFrame        The camera's frame.
  */
 
 void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	const Frame& eyeFrame) {
-	// Find minimimum and maximum x and y limits for the triangle
-	double xMin = glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x));
-	double xMax = glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x));
-	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
-	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
-
-	double fAlpha = f12(v0, v1, v2, v0.pos.x, v0.pos.y);
-	double fBeta = f20(v0, v1, v2, v1.pos.x, v1.pos.y);
-	double fGamma = f01(v0, v1, v2, v2.pos.x, v2.pos.y);
-
-	for (double y = yMin; y <= yMax; y++) {
-		for (double x = xMin; x <= xMax; x++) {
-			// Calculate the weights for inperpolation
-			// If any weight is negative, the fragment is not in the triangle
-			double alpha = f12(v0, v1, v2, x, y) / fAlpha;
-			double beta = f20(v0, v1, v2, x, y) / fBeta;
-			double gamma = f01(v0, v1, v2, x, y) / fGamma;
-
-			// Determine if the pixel position is inside the triangle
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				if ((alpha > 0 || fAlpha * f12(v0, v1, v2, -1, -1) > 0) &&
-					(beta > 0 || fBeta * f20(v0, v1, v2, -1, -1) > 0) &&
-					(gamma > 0 || fGamma * f01(v0, v1, v2, -1, -1) > 0)) {
-					Fragment fragment;
-
-					// Interpolate vertex attributes using alpha, beta, and gamma weights
-					fragment.material = barycentricWeighting(alpha, beta, gamma,
-						v0.material, v1.material, v2.material);
-					fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
-						v0.normal, v1.normal, v2.normal);
-					fragment.worldPos = barycentricWeighting(alpha, beta, gamma,
-						v0.worldPos, v1.worldPos, v2.worldPos);
-					double z = barycentricWeighting(alpha, beta, gamma,
-						v0.pos.z, v1.pos.z, v2.pos.z);
-					fragment.windowPos = dvec3(x, y, z);
-					FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-				}
-			}
-		}
+	const Material& material, const Frame& eyeFrame) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	TriangleSetup triangle;
+	if (triangle.setup(v0, v1, v2, W, H)) {
+		triangle.materialId = frameBuffer.getMaterialId(&material);
+		rasterizeTriangle(frameBuffer, eyePos, lights, material, triangle,
+			0, 0, W - 1, H - 1, eyeFrame);
 	}
 }
 
 /**
- * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const dmat4 &viewingMatrix)
- * @brief	Draw many filled triangles,
+ * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const vector<const Material*> &materials, const Frame &eyeFrame)
+ * @brief	Draw many filled triangles. With more than one thread, the triangles
+ * 			are set up, then sorted into RASTER_BIN_SIZE x RASTER_BIN_SIZE bins
+ * 			of the window by their bounding boxes, and the bins are rasterized
+ * 			and shaded in parallel. A bin's pixels are only written by its own
+ * 			thread, and it draws its triangles in the order they were given, so
+ * 			the result is the same as drawing them one at a time.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	vertices	 	The vector of vertice-triplets.
+ * @param 		  	materials	 	The material of each triangle.
  * @param 		  	eyeFrame    	The camera's frame.
  */
 
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
-	const Frame& eyeFrame) {
-	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
-		const VertexData& Vi = vertices[i];
-		const VertexData& Vi1 = vertices[i + 1];
-		const VertexData& Vi2 = vertices[i + 2];
-		drawFilledTriangle(frameBuffer, eyePos, lights, Vi, Vi1, Vi2, eyeFrame);
+	const vector<const Material*>& materials, const Frame& eyeFrame) {
+	ThreadPool& pool = ThreadPool::shared();
+	const int numTriangles = (int)vertices.size() / 3;
+	if (pool.getNumThreads() == 1 || numTriangles < RASTER_MIN_BINNED_TRIANGLES) {
+		for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
+			const VertexData& Vi = vertices[i];
+			const VertexData& Vi1 = vertices[i + 1];
+			const VertexData& Vi2 = vertices[i + 2];
+			drawFilledTriangle(frameBuffer, eyePos, lights, Vi, Vi1, Vi2, *materials[i / 3], eyeFrame);
+		}
+		return;
 	}
+
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int binsAcross = (W + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	const int binsDown = (H + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	// Kept from one call to the next. The lambdas run on other threads, so
+	// they must see the calling thread's buffers through these references.
+	static thread_local vector<TriangleSetup> triangleBuffer;
+	static thread_local vector<unsigned char> visibleBuffer;
+	static thread_local vector<vector<int>> binBuffer;
+	vector<TriangleSetup>& triangles = triangleBuffer;
+	vector<unsigned char>& visible = visibleBuffer;
+	vector<vector<int>>& bins = binBuffer;
+	triangles.resize(numTriangles);
+	visible.resize(numTriangles);
+	pool.parallelFor(numTriangles, [&](int t) {
+		visible[t] = triangles[t].setup(vertices[3 * t], vertices[3 * t + 1], vertices[3 * t + 2], W, H);
+	});
+	bins.resize(binsAcross * binsDown);
+	for (vector<int>& bin : bins) {
+		bin.clear();
+	}
+	// Palette ids are found here, once per run of triangles sharing a
+	// material, so the bins' threads never take the palette's lock.
+	const Material* idMaterial = nullptr;
+	int materialId = -1;
+	for (int t = 0; t < numTriangles; t++) {
+		if (!visible[t]) {
+			continue;
+		}
+		TriangleSetup& triangle = triangles[t];
+		if (materials[t] != idMaterial) {
+			materialId = frameBuffer.getMaterialId(materials[t]);
+			idMaterial = materials[t];
+		}
+		triangle.materialId = materialId;
+		for (int by = triangle.yMin / RASTER_BIN_SIZE; by <= triangle.yMax / RASTER_BIN_SIZE; by++) {
+			for (int bx = triangle.xMin / RASTER_BIN_SIZE; bx <= triangle.xMax / RASTER_BIN_SIZE; bx++) {
+				bins[by * binsAcross + bx].push_back(t);
+			}
+		}
+	}
+	pool.parallelFor((int)bins.size(), [&](int b) {
+		const int x0 = (b % binsAcross) * RASTER_BIN_SIZE;
+		const int y0 = (b / binsAcross) * RASTER_BIN_SIZE;
+		const int x1 = glm::min(x0 + RASTER_BIN_SIZE, W) - 1;
+		const int y1 = glm::min(y0 + RASTER_BIN_SIZE, H) - 1;
+		for (int t : bins[b]) {
+			rasterizeTriangle(frameBuffer, eyePos, lights, *materials[t], triangles[t],
+				x0, y0, x1, y1, eyeFrame);
+		}
+	});
 }
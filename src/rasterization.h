@@ -13,31 +13,39 @@
 #include "fragmentops.h"
 #include "vertexdata.h"
 
+const int RASTER_GROUP_SIZE = 4;	//!< Pixels the triangle rasterizer tests at once.
+const int RASTER_BLOCK_SIZE = FB_TILE_SIZE;	//!< Large triangles are rasterized in 8x8 blocks.
+const int RASTER_HIERARCHICAL_SIZE = 4 * RASTER_BLOCK_SIZE;	//!< ... if their box is at least this wide and tall.
+const double RASTER_BLOCK_MARGIN = 1E-9;	//!< Blocks this close to an edge are tested per pixel.
+const double RASTER_DEPTH_MARGIN = 1E-9;	//!< Geometry must be this far behind the depth buffer to be culled.
+const int RASTER_BIN_SIZE = 8 * FB_TILE_SIZE;	//!< Triangles are sorted into 64x64 bins, drawn in parallel.
+const int RASTER_MIN_BINNED_TRIANGLES = 16;	//!< Fewer triangles than this are drawn on one thread.
+
 void drawAxisOnWindow(FrameBuffer& frameBuffer);
 void drawWirePolygon(FrameBuffer& frameBuffer, const vector<dvec3>& pts, const color& rgb);
 void drawLine(FrameBuffer& frameBuffer, int x1, int y1, int x2, int y2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec2& pt1, const dvec2& pt2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	vector<LightSourcePtr>& lights,
+	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1,
-	const Frame& eyeFrame);
+	const Material& material, const Frame& eyeFrame);
 void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
-	const Frame& eyeFrame);
+	const Material& material, const Frame& eyeFrame);
 void drawWireFrameTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	const Frame& eyeFrame);
+	const Material& material, const Frame& eyeFrame);
 void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	vector<LightSourcePtr>& lights, const VertexData& v0,
+	const vector<LightSourcePtr>& lights, const VertexData& v0,
 	const VertexData& v1, const VertexData& v2,
-	const Frame& eyeFrame);
+	const Material& material, const Frame& eyeFrame);
 void drawManyWireFrameTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& vertices,
-	const Frame& eyeFrame);
+	const Material& material, const Frame& eyeFrame);
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
-	const Frame& eyeFrame);
+	const vector<const Material*>& materials, const Frame& eyeFrame);
 void drawArc(FrameBuffer& fb, const dvec2& center, double R,
 	double startRads, double lengthInRads, const color& rgb);
\ No newline at end of file
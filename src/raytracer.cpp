@@ -9,6 +9,7 @@
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
+#include "denoiser.h"
 
  /**
   * @fn	RayTracer::RayTracer(const color &defa)
@@ -17,64 +18,548 @@
   */
 
 RayTracer::RayTracer(const color& defa)
-	: defaultColor(defa) {
+	: defaultColor(defa), antiAliasing(1), resolutionDivisor(1), shadowSamples(1),
+	checkerboard(false), cacheSecondary(false), history(nullptr), denoiseIterations(0) {
 }
 
 /**
- * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @fn	static double halton(int index, int base)
+ * @brief	Element of the Halton low discrepancy sequence.
+ * @param	index	Index into the sequence.
+ * @param	base 	Prime base.
+ * @return	A value in [0, 1).
+ */
+
+static double halton(int index, int base) {
+	double f = 1.0, result = 0.0;
+	while (index > 0) {
+		f /= base;
+		result += f * (index % base);
+		index /= base;
+	}
+	return result;
+}
+
+/**
+ * @fn	static dvec2 passJitter(int pass)
+ * @brief	Where a pass samples within each stratum. Pass 0 samples the centers,
+ * 			and later passes follow a Halton sequence.
+ * @param	pass	Number of passes already accumulated.
+ * @return	The offset within a stratum, in [0, 1) on each axis.
+ */
+
+static dvec2 passJitter(int pass) {
+	return pass == 0 ? dvec2(0.5, 0.5) : dvec2(halton(pass, 2), halton(pass, 3));
+}
+
+/**
+ * @fn	bool RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene,
+ *										const std::atomic<bool>* cancel) const
+ * @brief	Raytrace scene, one framebuffer tile at a time. If the framebuffer is
+ * 			accumulating, each pixel's average is added to its accumulation buffer,
+ * 			weighted by the number of samples, and it is resolved. Calling this
+ * 			repeatedly without clearing refines the image progressively. Makes no
+ * 			OpenGL calls, so it can run on any thread; the caller shows the result.
+ * 			Another thread can stop the frame early by setting *cancel, which is
+ * 			checked before each tile. The framebuffer is then only partly updated,
+ * 			and its accumulation buffer is left unresolved. If resolutionDivisor
+ * 			is more than 1, the scene is shaded at reduced resolution and then
+ * 			upsampled (see upsampleTile). Otherwise, if there is a history or the
+ * 			frame is to be denoised, the whole frame is traced at once (see traceFrame).
  * @param [in,out]	frameBuffer	Framebuffer.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
+ * @param 		  	cancel	   	If not nullptr, set to true to abandon the frame.
+ * @return	True if the frame was finished, false if it was cancelled.
  */
 
-void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
-	const IScene& theScene) const {
-	const RaytracingCamera& camera = *theScene.camera;
+bool RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
+	const IScene& theScene, const std::atomic<bool>* cancel) const {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int N = glm::max(antiAliasing, 1);
+	const int D = glm::clamp(resolutionDivisor, 1, FB_TILE_SIZE);
+	const bool accumulate = frameBuffer.isAccumulating();
+	const int pass = accumulate ? frameBuffer.getAccumulatedPasses() : 0;
+	const int lowW = (W + D - 1) / D;
+	const int lowH = (H + D - 1) / D;
+	vector<GBufferSample> lowRes;
+	color colors[FB_TILE_AREA];
 
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
-			// This is for debugging a particular ray for a particular pixel
-			// Set a breakpoint on the cout line below
-			// Right click on a pixel
-			// Make the rendering window re-render: spacebar or click on the window
-			DEBUG_PIXEL = (x == xDebug && y == yDebug);
-			if (DEBUG_PIXEL) {
-				cout << "";
-			}
-			/* CSE 386 - todo  */
-			// Only work with the first shape
-			Ray ray = camera.getRay(x, y);
-			
-			color total_c = RayTracer::traceIndividualRay(ray, theScene, depth);
+	if (D > 1) {
+		if (history != nullptr) {
+			history->clear();
+		}
+		if (!traceReducedResolution(theScene, depth, lowW, lowH, pass, lowRes, cancel)) {
+			return false;
+		}
+	} else if (history != nullptr || denoiseIterations > 0) {
+		return traceFrame(frameBuffer, depth, theScene, pass, cancel);
+	}
+	for (int y0 = 0; y0 < H; y0 += FB_TILE_SIZE) {
+		for (int x0 = 0; x0 < W; x0 += FB_TILE_SIZE) {
+			if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+				return false;
+			}
+			int w = glm::min(FB_TILE_SIZE, W - x0);
+			int h = glm::min(FB_TILE_SIZE, H - y0);
+			if (D > 1) {
+				upsampleTile(theScene, lowRes, lowW, lowH, x0, y0, w, h, colors);
+			} else {
+				traceTile(theScene, depth, x0, y0, w, h, pass, colors);
+			}
+			if (accumulate) {
+				for (int j = 0; j < h; j++) {
+					for (int i = 0; i < w; i++) {
+						frameBuffer.accumulateColor(x0 + i, y0 + j, colors[j * w + i], N * N);
+					}
+				}
+			} else {
+				frameBuffer.setColorTile(x0, y0, w, h, colors);
+			}
+		}
+	}
 
-			total_c.x = total_c.x > 1 ? 1 : total_c.x;
-			total_c.y = total_c.y > 1 ? 1 : total_c.y;
-			total_c.z = total_c.z > 1 ? 1 : total_c.z;
+	if (accumulate) {
+		frameBuffer.resolveAccumBuffer();
+	}
+	return true;
+}
 
+/**
+ * @fn	void RayTracer::traceTile(const IScene& theScene, int depth, int x0, int y0, int w, int h,
+ *									int pass, color* colors) const
+ * @brief	Traces a block of pixels at full resolution, ignoring the history,
+ * 			checkerboard and denoiser. Any block size may be used, so it can be
+ * 			handed out by a RenderFarm.
+ * @param 		  	theScene	The scene.
+ * @param 		  	depth   	The current depth of recursion.
+ * @param 		  	x0			The x coordinate of the block's lower left pixel.
+ * @param 		  	y0			The y coordinate of the block's lower left pixel.
+ * @param 		  	w			Width of the block.
+ * @param 		  	h			Height of the block.
+ * @param 		  	pass		Number of passes already accumulated.
+ * @param [out]	  	colors		w * h average colors, row-major, bottom row first.
+ */
 
-			frameBuffer.setColor(x, y, total_c);
+void RayTracer::traceTile(const IScene& theScene, int depth, int x0, int y0, int w, int h,
+	int pass, color* colors) const {
+	const dvec2 jitter = passJitter(pass);
+	for (int y = y0; y < y0 + h; ++y) {
+		for (int x = x0; x < x0 + w; ++x) {
+			colors[(y - y0) * w + (x - x0)] = tracePixel(theScene, depth, x, y, 1, jitter);
 			//frameBuffer.showAxes(x, y, ray, 0.25);			// Displays R/x, G/y, B/z axes
 		}
 	}
+}
+
+/**
+ * @fn	color RayTracer::tracePixel(const IScene& theScene, int depth, int x, int y, int size,
+ *									const dvec2& jitter, GBufferSample* center,
+ *									bool reuseSecondary) const
+ * @brief	Traces a size x size block of pixels as though it were one pixel, with
+ * 			antiAliasing x antiAliasing stratified samples.
+ * @param 		  	theScene	The scene.
+ * @param 		  	depth   	The current depth of recursion.
+ * @param 		  	x			The x coordinate of the block's lower left pixel.
+ * @param 		  	y			The y coordinate of the block's lower left pixel.
+ * @param 		  	size		Width and height of the block, in pixels.
+ * @param 		  	jitter		Where to sample within each stratum (see passJitter).
+ * @param [in,out]	center  	If not nullptr, gets the primary hit of the middle
+ * 								sample. That is the block's center only when
+ * 								antiAliasing is odd and the jitter is (0.5, 0.5).
+ * @param 		  	reuseSecondary	If true, the middle sample may reuse the previous
+ * 								frame's secondary rays (see traceIndividualRay).
+ * @param [out]	  	variance	If not nullptr, gets the estimated variance of the
+ * 								result: the variance of the samples' mean if there
+ * 								are several, otherwise that of its soft shadows.
+ * @return	The average color of the samples.
+ */
+
+color RayTracer::tracePixel(const IScene& theScene, int depth, int x, int y, int size,
+	const dvec2& jitter, GBufferSample* center, bool reuseSecondary, double* variance) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const int N = glm::max(antiAliasing, 1);
+
+	// This is for debugging a particular ray for a particular pixel
+	// Set a breakpoint on the cout line below
+	// Right click on a pixel
+	// Make the rendering window re-render: spacebar or click on the window
+	DEBUG_PIXEL = (x == xDebug && y == yDebug);
+	if (DEBUG_PIXEL) {
+		cout << "";
+	}
+	color total_c;
+	color total_sq;
+	GBufferSample hit;
+	for (int j = 0; j < N; j++) {
+		for (int i = 0; i < N; i++) {
+			// getRay samples the pixel center, so offsets are in [-0.5, 0.5)
+			double dx = size * ((i + jitter.x) / N - 0.5) + (size - 1) / 2.0;
+			double dy = size * ((j + jitter.y) / N - 0.5) + (size - 1) / 2.0;
+			Ray ray = camera.getRay(x + dx, y + dy);
+			bool middle = i == N / 2 && j == N / 2;
+			GBufferSample* primary = (middle && center != nullptr) || (variance != nullptr && N == 1) ?
+				&hit : nullptr;
+			color c = RayTracer::traceIndividualRay(ray, theScene, depth, primary, middle && reuseSecondary);
+			total_c += c;
+			total_sq += c * c;
+			if (middle && center != nullptr) {
+				*center = hit;
+			}
+		}
+	}
+	const double n = N * N;
+	if (variance != nullptr) {
+		if (N == 1) {
+			*variance = hit.variance;
+		} else {
+			color sampleVariance = (total_sq - total_c * total_c / n) / (n - 1.0);
+			*variance = glm::max((sampleVariance.r + sampleVariance.g + sampleVariance.b) / 3.0, 0.0) / n;
+		}
+	}
+	return total_c / n;
+}
+
+/**
+ * @fn	static void setGBufferSample(const Ray& ray, const OpaqueHitRecord& hit, GBufferSample& sample)
+ * @brief	Copies a primary hit's depth, position, normal and albedo into a sample.
+ * @param 		  	ray   	The primary ray.
+ * @param 		  	hit   	The primary hit.
+ * @param [in,out]	sample	The sample. The color is unchanged.
+ */
+
+static void setGBufferSample(const Ray& ray, const OpaqueHitRecord& hit, GBufferSample& sample) {
+	sample.direction = ray.dir;
+	sample.albedo = hit.material.diffuse;
+	if (hit.t != FLT_MAX && hit.texture != nullptr) {
+		sample.albedo = 0.5 * sample.albedo + 0.5 * hit.texture->getPixelUV(hit.u, hit.v);
+	}
+	sample.hasSecondary = false;
+	sample.depth = hit.t;
+	sample.position = hit.t == FLT_MAX ? dvec3(0, 0, 0) : hit.interceptPt;
+	sample.normal = hit.t == FLT_MAX ? dvec3(0, 0, 0) : hit.normal;
+}
+
+/**
+ * @fn	void RayTracer::traceGBufferSample(const IScene& theScene, double x, double y,
+ *											GBufferSample& sample) const
+ * @brief	Finds the depth, position and normal of the closest opaque object seen through (x, y),
+ * 			and whether a transparent object is in front of it. Does no shading, so it is much
+ * 			cheaper than traceIndividualRay.
+ * @param 		  	theScene	The scene.
+ * @param 		  	x			The x coordinate.
+ * @param 		  	y			The y coordinate.
+ * @param [in,out]	sample  	Gets the depth, position and normal. The color is unchanged.
+ */
+
+void RayTracer::traceGBufferSample(const IScene& theScene, double x, double y,
+	GBufferSample& sample) const {
+	Ray ray = theScene.camera->getRay(x, y);
+	OpaqueHitRecord hit;
+	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hit);
+	setGBufferSample(ray, hit, sample);
+	TransparentHitRecord transHit;
+	TransparentIShape::findIntersection(ray, theScene.transparentObjs, transHit);
+	sample.throughTransparent = transHit.t < hit.t;
+	sample.reflectionThroughTransparent = false;
+}
+
+/**
+ * @fn	bool RayTracer::traceReducedResolution(const IScene& theScene, int depth, int lowW, int lowH,
+ *									int pass, vector<GBufferSample>& samples,
+ *									const std::atomic<bool>* cancel) const
+ * @brief	Shades one sample per resolutionDivisor x resolutionDivisor block of
+ * 			pixels, and records the depth and normal at the block's center.
+ * @param 		  	theScene	The scene.
+ * @param 		  	depth   	The current depth of recursion.
+ * @param 		  	lowW		Blocks in a row.
+ * @param 		  	lowH		Rows of blocks.
+ * @param 		  	pass		Number of passes already accumulated.
+ * @param [out]	  	samples 	lowW * lowH samples, row-major, bottom row first.
+ * @param 		  	cancel  	If not nullptr, checked before each row.
+ * @return	True if finished, false if cancelled.
+ */
+
+bool RayTracer::traceReducedResolution(const IScene& theScene, int depth, int lowW, int lowH,
+	int pass, vector<GBufferSample>& samples, const std::atomic<bool>* cancel) const {
+	const int D = glm::clamp(resolutionDivisor, 1, FB_TILE_SIZE);
+	const dvec2 jitter = passJitter(pass);
+	const bool centered = (antiAliasing & 1) != 0 && pass == 0;
+	samples.resize(lowW * lowH);
+	for (int j = 0; j < lowH; j++) {
+		if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+			return false;
+		}
+		for (int i = 0; i < lowW; i++) {
+			GBufferSample& sample = samples[j * lowW + i];
+			sample.C = tracePixel(theScene, depth, i * D, j * D, D, jitter, centered ? &sample : nullptr);
+			if (!centered) {
+				traceGBufferSample(theScene, i * D + (D - 1) / 2.0, j * D + (D - 1) / 2.0, sample);
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	static double edgeWeight(const GBufferSample& sample, const GBufferSample& pixel)
+ * @brief	How much a reduced resolution sample resembles the surface seen by a
+ * 			pixel. Falls off with the relative difference in depth and with the
+ * 			angle between the normals.
+ * @param	sample	The reduced resolution sample.
+ * @param	pixel 	The pixel's depth and normal.
+ * @return	A weight in [0, 1].
+ */
+
+static double edgeWeight(const GBufferSample& sample, const GBufferSample& pixel) {
+	if (sample.depth == FLT_MAX || pixel.depth == FLT_MAX) {
+		return sample.depth == pixel.depth ? 1.0 : 0.0;
+	}
+	double dz = (sample.depth - pixel.depth) / (UPSAMPLE_DEPTH_SIGMA * pixel.depth);
+	double cosine = glm::max(glm::dot(sample.normal, pixel.normal), 0.0);
+	return std::exp(-dz * dz) * std::pow(cosine, UPSAMPLE_NORMAL_POWER);
+}
+
+/**
+ * @fn	void RayTracer::upsampleTile(const IScene& theScene, const vector<GBufferSample>& samples,
+ *									int lowW, int lowH, int x0, int y0, int w, int h,
+ *									color* colors) const
+ * @brief	Joint bilateral upsample of a block of pixels. Each pixel's depth and
+ * 			normal are found at full resolution, and each pixel blends the four
+ * 			nearest reduced resolution samples, weighted bilinearly and by how
+ * 			well their depth and normal match. Silhouettes and creases therefore
+ * 			stay sharp. If none match, the sample closest in depth is used.
+ * @param 		  	theScene	The scene.
+ * @param 		  	samples 	The reduced resolution samples.
+ * @param 		  	lowW		Samples in a row.
+ * @param 		  	lowH		Rows of samples.
+ * @param 		  	x0			The x coordinate of the block's lower left pixel.
+ * @param 		  	y0			The y coordinate of the block's lower left pixel.
+ * @param 		  	w			Width of the block.
+ * @param 		  	h			Height of the block.
+ * @param [out]	  	colors		w * h colors, row-major, bottom row first.
+ */
+
+void RayTracer::upsampleTile(const IScene& theScene, const vector<GBufferSample>& samples,
+	int lowW, int lowH, int x0, int y0, int w, int h, color* colors) const {
+	const int D = glm::clamp(resolutionDivisor, 1, FB_TILE_SIZE);
+	const double center = (D - 1) / 2.0;
+	GBufferSample pixel;
+
+	for (int y = y0; y < y0 + h; ++y) {
+		double v = (y - center) / D;
+		int j0 = (int)std::floor(v);
+		double fy = v - j0;
+		for (int x = x0; x < x0 + w; ++x) {
+			double u = (x - center) / D;
+			int i0 = (int)std::floor(u);
+			double fx = u - i0;
+			traceGBufferSample(theScene, x, y, pixel);
+
+			color total_c;
+			double totalWeight = 0.0;
+			double closest = DBL_MAX;
+			const GBufferSample* fallback = nullptr;
+			for (int dj = 0; dj <= 1; dj++) {
+				int j = glm::clamp(j0 + dj, 0, lowH - 1);
+				double wy = dj == 0 ? 1.0 - fy : fy;
+				for (int di = 0; di <= 1; di++) {
+					int i = glm::clamp(i0 + di, 0, lowW - 1);
+					double wx = di == 0 ? 1.0 - fx : fx;
+					const GBufferSample& sample = samples[j * lowW + i];
+					double weight = wx * wy * edgeWeight(sample, pixel);
+					total_c += weight * sample.C;
+					totalWeight += weight;
+					double dz = std::abs(sample.depth - pixel.depth);
+					if (dz < closest) {
+						closest = dz;
+						fallback = &sample;
+					}
+				}
+			}
+			colors[(y - y0) * w + (x - x0)] = totalWeight > EPSILON ? total_c / totalWeight : fallback->C;
+		}
+	}
+}
+
+/**
+ * @fn	bool RayTracer::traceFrame(FrameBuffer& frameBuffer, int depth, const IScene& theScene,
+ *										int pass, const std::atomic<bool>* cancel) const
+ * @brief	Traces a full resolution frame, keeping the primary hit of every
+ * 			pixel. It is then denoised, if denoiseIterations is set, and stored in
+ * 			the history, if there is one. The noise the denoiser expects shrinks
+ * 			as passes accumulate, so a still image converges. If
+ * 			cacheSecondary is set, pixels whose middle sample is centered may
+ * 			reuse the previous frame's secondary rays, and every pixel retraces
+ * 			them at least once every SECONDARY_REFRESH_FRAMES frames. In
+ * 			checkerboard mode, the first pass of a frame only traces the pixels
+ * 			of one color of a checkerboard, alternating every frame, and the rest
+ * 			are reconstructed (see reconstructPixel). Every pixel still finds its
+ * 			depth, position and normal, which is much cheaper than shading.
+ * 			Checkerboard mode and cacheSecondary need a history.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	depth	   	The current depth of recursion.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	pass	   	Number of passes already accumulated.
+ * @param 		  	cancel	   	If not nullptr, checked before each row.
+ * @return	True if the frame was finished, false if it was cancelled.
+ */
+
+bool RayTracer::traceFrame(FrameBuffer& frameBuffer, int depth, const IScene& theScene,
+	int pass, const std::atomic<bool>* cancel) const {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int N = glm::max(antiAliasing, 1);
+	const bool accumulate = frameBuffer.isAccumulating();
+	const bool interleave = checkerboard && pass == 0 && history != nullptr;
+	const int frameCount = history != nullptr ? history->getFrameCount() : 0;
+	const int parity = frameCount & 1;
+	const dvec2 jitter = passJitter(pass);
+	const bool centered = (antiAliasing & 1) != 0 && pass == 0;
+	vector<GBufferSample> samples(W * H);
+	color colors[FB_TILE_AREA];
+
+	for (int y = 0; y < H; y++) {
+		if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+			return false;
+		}
+		for (int x = 0; x < W; x++) {
+			GBufferSample& sample = samples[y * W + x];
+			if (!interleave || ((x + y + parity) & 1) == 0) {
+				// Staggered, so that each frame retraces an even share of the cache
+				bool reuse = cacheSecondary && history != nullptr &&
+					(x + 3 * y + frameCount) % SECONDARY_REFRESH_FRAMES != 0;
+				sample.C = tracePixel(theScene, depth, x, y, 1, jitter, centered ? &sample : nullptr, reuse,
+					&sample.variance);
+				if (centered) {
+					continue;
+				}
+			}
+			traceGBufferSample(theScene, x, y, sample);
+		}
+	}
+	if (interleave) {
+		// Only traced pixels are neighbors of untraced ones, so this can work in place
+		for (int y = 0; y < H; y++) {
+			for (int x = (y + parity + 1) & 1; x < W; x += 2) {
+				samples[y * W + x].C = reconstructPixel(samples, W, H, x, y);
+			}
+		}
+	}
 
-	frameBuffer.showColorBuffer();
+	for (int y0 = 0; y0 < H; y0 += FB_TILE_SIZE) {
+		for (int x0 = 0; x0 < W; x0 += FB_TILE_SIZE) {
+			int w = glm::min(FB_TILE_SIZE, W - x0);
+			int h = glm::min(FB_TILE_SIZE, H - y0);
+			for (int j = 0; j < h; j++) {
+				for (int i = 0; i < w; i++) {
+					colors[j * w + i] = samples[(y0 + j) * W + x0 + i].C;
+				}
+			}
+			if (accumulate) {
+				for (int j = 0; j < h; j++) {
+					for (int i = 0; i < w; i++) {
+						frameBuffer.accumulateColor(x0 + i, y0 + j, colors[j * w + i], N * N);
+					}
+				}
+			} else {
+				frameBuffer.setColorTile(x0, y0, w, h, colors);
+			}
+		}
+	}
+	if (accumulate) {
+		frameBuffer.resolveAccumBuffer();
+	}
+	if (denoiseIterations > 0) {
+		int passes = accumulate ? frameBuffer.getAccumulatedPasses() : 1;
+		Denoiser::denoise(frameBuffer, samples, denoiseIterations, 1.0 / passes);
+	}
+	if (history != nullptr) {
+		history->store(*theScene.camera, W, H, samples);
+	}
+	return true;
 }
 
+/**
+ * @fn	color RayTracer::reconstructPixel(const vector<GBufferSample>& samples, int W, int H,
+ *										int x, int y) const
+ * @brief	Estimates the color of an untraced checkerboard pixel. If the previous
+ * 			frame saw the same surface, its color is reused, clamped to the range
+ * 			of the traced neighbors on that surface so that changes in shading do
+ * 			not leave trails. Otherwise the neighbors are blended, weighted by
+ * 			how well their depth and normal match.
+ * @param	samples	The frame's samples. The four neighbors of (x, y) are traced.
+ * @param	W	   	Width of the frame.
+ * @param	H	   	Height of the frame.
+ * @param	x	   	The x coordinate of the pixel.
+ * @param	y	   	The y coordinate of the pixel.
+ * @return	The pixel's color.
+ */
+
+color RayTracer::reconstructPixel(const vector<GBufferSample>& samples, int W, int H,
+	int x, int y) const {
+	static const int NEIGHBORS[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	const GBufferSample& pixel = samples[y * W + x];
+	color total_c;
+	color lo(DBL_MAX), hi(-DBL_MAX);
+	double totalWeight = 0.0;
+	double closest = DBL_MAX;
+	color spatial = defaultColor;
+
+	for (int n = 0; n < 4; n++) {
+		int nx = x + NEIGHBORS[n][0];
+		int ny = y + NEIGHBORS[n][1];
+		if (nx < 0 || nx >= W || ny < 0 || ny >= H) {
+			continue;
+		}
+		const GBufferSample& sample = samples[ny * W + nx];
+		double weight = edgeWeight(sample, pixel);
+		if (weight > EPSILON) {
+			total_c += weight * sample.C;
+			totalWeight += weight;
+			lo = glm::min(lo, sample.C);
+			hi = glm::max(hi, sample.C);
+		}
+		double dz = std::abs(sample.depth - pixel.depth);
+		if (dz < closest) {
+			closest = dz;
+			spatial = sample.C;
+		}
+	}
+	if (totalWeight > EPSILON) {
+		spatial = total_c / totalWeight;
+	} else {
+		lo = hi = spatial;
+	}
 
+	color previous;
+	if (history->reproject(pixel, previous)) {
+		return glm::clamp(previous, lo, hi);
+	}
+	return spatial;
+}
 
 /**
  * @fn	color raytracer::traceindividualray(const ray &ray,
  *											const iscene &thescene,
- *											int recursionlevel) const
+ *											int recursionlevel,
+ *											GBufferSample* primary,
+ *											bool reuseSecondary) const
  * @brief	trace an individual ray.
  * @param	ray			  	the ray.
  * @param	thescene	  	the scene.
  * @param	recursionlevel	the recursion level.
+ * @param	primary			if not nullptr, gets the depth, position and normal of the
+ * 							hit, the results of its shadow and reflection rays, and
+ * 							the estimated variance of the returned color.
+ * @param	reuseSecondary	if true, and the history has the primary hit's shadow and
+ * 							reflection results, they are reused instead of traced.
  * @return	the color to be displayed as a result of this ray.
  */
 
-color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const {
+color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel,
+	GBufferSample* primary, bool reuseSecondary) const {
 	/* CSE 386 - todo  */
 	// This might be a useful helper function.
 	if (recursionLevel < 0) {
@@ -87,6 +572,15 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 
 	OpaqueHitRecord opaqueHit;
 	VisibleIShape::findIntersection(ray, opaqueObjs, opaqueHit);
+	GBufferSample cached;
+	bool useCache = false;
+	bool keep = false;
+	if (primary != nullptr) {
+		setGBufferSample(ray, opaqueHit, *primary);
+		useCache = reuseSecondary && history != nullptr &&
+			history->reprojectSecondary(*primary, (int)lights.size(), cached);
+		keep = opaqueHit.t != FLT_MAX && lights.size() <= MAX_CACHED_LIGHTS;
+	}
 
 	TransparentHitRecord transHit;
 	TransparentIShape::findIntersection(ray, transObjs, transHit);
@@ -95,18 +589,47 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 	// hitRecord will have the information about t, the interceptPt, normal, material and texture
 	color total_c;
 	color c;
-	bool inShadow;
-	for (auto light : lights) {
+	double variance = 0.0;
+	for (size_t l = 0; l < lights.size(); l++) {
+		const PositionalLightPtr& light = lights[l];
 		if (opaqueHit.t != FLT_MAX) {
-			inShadow = light->pointIsInAShadow(opaqueHit.interceptPt,
-				opaqueHit.normal,
-				opaqueObjs,
-				camera.getFrame());
+			double visibility = 1.0;
+			if (useCache) {
+				visibility = cached.visibility[l];
+			} else if (shadowSamples == 1) {
+				visibility = light->pointIsInAShadow(opaqueHit.interceptPt,
+					opaqueHit.normal,
+					opaqueObjs,
+					camera.getFrame()) ? 0.0 : 1.0;
+			} else if (shadowSamples > 1) {
+				visibility = light->visibility(opaqueHit.interceptPt,
+					opaqueHit.normal, opaqueObjs, shadowSamples);
+			}
+			if (keep) {
+				primary->visibility[l] = visibility;
+			}
 			color material_c = light->illuminate(opaqueHit.interceptPt,
 				opaqueHit.normal,
 				opaqueHit.material,
 				camera.getFrame(),
-				inShadow);
+				visibility == 0.0);
+			if (visibility > 0.0 && visibility < 1.0) {
+				// Penumbra: blend the lit and shadowed colors
+				color shadowed_c = light->illuminate(opaqueHit.interceptPt,
+					opaqueHit.normal,
+					opaqueHit.material,
+					camera.getFrame(),
+					true);
+				if (!useCache && shadowSamples > 1) {
+					// Each feeler is a coin toss, so visibility has variance v(1 - v) / n
+					color d = material_c - shadowed_c;
+					double scale = (opaqueHit.texture != nullptr ? 0.5 : 1.0) *
+						(transHit.t < opaqueHit.t ? 1.0 - transHit.alpha : 1.0);
+					variance += visibility * (1.0 - visibility) / shadowSamples *
+						glm::dot(d, d) / 3.0 * scale * scale;
+				}
+				material_c = visibility * material_c + (1.0 - visibility) * shadowed_c;
+			}
 			if (opaqueHit.texture != nullptr) {
 				color texture_c = opaqueHit.texture->getPixelUV(opaqueHit.u, opaqueHit.v);
 				c = 0.5 * material_c + 0.5 * texture_c;
@@ -129,11 +652,33 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 		total_c = total_c + c;
 	}
 
-	dvec3 reflect_origin = opaqueHit.interceptPt + EPSILON * opaqueHit.normal;
-	dvec3 reflect_dir = ray.dir - 2 * glm::dot(ray.dir, opaqueHit.normal) * opaqueHit.normal;
-	Ray reflect_ray(reflect_origin, reflect_dir);
-
 	color reflect_color = defaultColor;
-	reflect_color = RayTracer::traceIndividualRay(reflect_ray, theScene, recursionLevel - 1);
+	GBufferSample reflected;
+	reflected.depth = FLT_MAX;
+	reflected.variance = 0.0;
+	reflected.throughTransparent = false;
+	reflected.reflectionThroughTransparent = false;
+	if (useCache) {
+		reflect_color = cached.reflection;
+		reflected.depth = cached.reflectionDepth;
+		reflected.throughTransparent = cached.reflectionThroughTransparent;
+	} else {
+		dvec3 reflect_origin = opaqueHit.interceptPt + EPSILON * opaqueHit.normal;
+		dvec3 reflect_dir = ray.dir - 2 * glm::dot(ray.dir, opaqueHit.normal) * opaqueHit.normal;
+		Ray reflect_ray(reflect_origin, reflect_dir);
+		reflect_color = RayTracer::traceIndividualRay(reflect_ray, theScene, recursionLevel - 1,
+			primary != nullptr ? &reflected : nullptr);
+	}
+	if (primary != nullptr) {
+		primary->variance = variance + 0.09 * reflected.variance;
+		primary->throughTransparent = transHit.t < opaqueHit.t;
+		primary->reflectionThroughTransparent = reflected.throughTransparent ||
+			reflected.reflectionThroughTransparent;
+	}
+	if (keep) {
+		primary->reflection = reflect_color;
+		primary->reflectionDepth = reflected.depth;
+		primary->hasSecondary = true;
+	}
 	return total_c + 0.3 * reflect_color;
 }
@@ -9,10 +9,15 @@
 
 #pragma once
 
+#include <atomic>
 #include "utilities.h"
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "renderhistory.h"
+
+const double UPSAMPLE_DEPTH_SIGMA = 0.05;	//!< Depth tolerance of the upsample, relative to depth.
+const double UPSAMPLE_NORMAL_POWER = 16.0;	//!< Sharpness of the upsample's normal test.
 
  /**
   * @struct	RayTracer
@@ -21,9 +26,29 @@
 
 struct RayTracer {
 	color defaultColor;			//!< the color to use if no intersection is present.
+	int antiAliasing;			//!< samples per pixel along each axis (N x N per pass).
+	int resolutionDivisor;		//!< 1, 2, 4 or 8. One shaded sample per divisor x divisor block of pixels.
+	int shadowSamples;			//!< shadow feelers per light. 0 = no shadows, 1 = hard, more = soft.
+	bool checkerboard;			//!< trace half the pixels of each new frame, reconstruct the rest.
+	bool cacheSecondary;		//!< reuse the previous frame's shadow and reflection rays.
+	RenderHistory* history;		//!< the previous frame, or nullptr to keep no history.
+	int denoiseIterations;		//!< a-trous passes over full resolution frames, 0 for none.
 	RayTracer(const color& defaultColor);
-	void raytraceScene(FrameBuffer& frameBuffer, int depth,
-		const IScene& theScene) const;
+	bool raytraceScene(FrameBuffer& frameBuffer, int depth,
+		const IScene& theScene, const std::atomic<bool>* cancel = nullptr) const;
+	void traceTile(const IScene& theScene, int depth, int x0, int y0, int w, int h,
+		int pass, color* colors) const;
 protected:
-	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const;
+	color tracePixel(const IScene& theScene, int depth, int x, int y, int size, const dvec2& jitter,
+		GBufferSample* center = nullptr, bool reuseSecondary = false, double* variance = nullptr) const;
+	void traceGBufferSample(const IScene& theScene, double x, double y, GBufferSample& sample) const;
+	bool traceReducedResolution(const IScene& theScene, int depth, int lowW, int lowH, int pass,
+		vector<GBufferSample>& samples, const std::atomic<bool>* cancel) const;
+	void upsampleTile(const IScene& theScene, const vector<GBufferSample>& samples, int lowW, int lowH,
+		int x0, int y0, int w, int h, color* colors) const;
+	bool traceFrame(FrameBuffer& frameBuffer, int depth, const IScene& theScene, int pass,
+		const std::atomic<bool>* cancel) const;
+	color reconstructPixel(const vector<GBufferSample>& samples, int W, int H, int x, int y) const;
+	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel,
+		GBufferSample* primary = nullptr, bool reuseSecondary = false) const;
 };
\ No newline at end of file
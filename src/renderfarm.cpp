@@ -0,0 +1,539 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "renderfarm.h"
+
+#ifndef WINDOWS
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef std::chrono::steady_clock FarmClock;
+
+#ifndef WINDOWS
+
+/**
+ * @fn	static bool readFully(int fd, void* data, size_t size)
+ * @brief	Reads exactly size bytes from a socket.
+ * @param 	  	fd  	The socket.
+ * @param [out]	data	Where to put the bytes.
+ * @param 	  	size	Number of bytes.
+ * @return	False if the other end closed the socket or an error occurred.
+ */
+
+static bool readFully(int fd, void* data, size_t size) {
+	char* p = static_cast<char*>(data);
+	while (size > 0) {
+		ssize_t n = ::recv(fd, p, size, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @fn	static bool writeFully(int fd, const void* data, size_t size)
+ * @brief	Writes exactly size bytes to a socket. Does not raise SIGPIPE if
+ * 			the other end is gone.
+ * @param	fd  	The socket.
+ * @param	data	The bytes.
+ * @param	size	Number of bytes.
+ * @return	False if the other end closed the socket or an error occurred.
+ */
+
+static bool writeFully(int fd, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+#endif
+
+/**
+ * @fn	static void storeTile(FrameBuffer& frameBuffer, const FarmTileJob& job, const color* colors, int samples)
+ * @brief	Puts a finished tile in the framebuffer, the same way raytraceScene does.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	job		   	The tile.
+ * @param 		  	colors	   	job.w * job.h colors, row-major, bottom row first.
+ * @param 		  	samples	   	Samples per pixel, the weight if accumulating.
+ */
+
+static void storeTile(FrameBuffer& frameBuffer, const FarmTileJob& job, const color* colors, int samples) {
+	if (frameBuffer.isAccumulating()) {
+		for (int j = 0; j < job.h; j++) {
+			for (int i = 0; i < job.w; i++) {
+				frameBuffer.accumulateColor(job.x0 + i, job.y0 + j, colors[j * job.w + i], samples);
+			}
+		}
+	} else {
+		frameBuffer.setColorTile(job.x0, job.y0, job.w, job.h, colors);
+	}
+}
+
+/**
+ * @fn	RenderFarm::RenderFarm(const RayTracer& rayTracer, const IScene& theScene, int depth, int numWorkers)
+ * @brief	Starts the workers. Each gets a copy of the ray tracer and scene as
+ * 			they are now; later changes to either are not seen by the farm, so a
+ * 			new farm is needed when the scene or camera changes.
+ * @param	rayTracer 	The ray tracer.
+ * @param	theScene  	The scene.
+ * @param	depth	  	The recursion depth.
+ * @param	numWorkers	Number of worker processes.
+ */
+
+RenderFarm::RenderFarm(const RayTracer& rayTracer, const IScene& theScene, int depth, int numWorkers)
+	: rayTracer(rayTracer), scene(theScene), depth(depth), frame(0) {
+#ifndef WINDOWS
+	std::cout.flush();
+	std::cerr.flush();
+	for (int i = 0; i < numWorkers; i++) {
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+			std::cerr << "Could not make a socket for render worker " << i << std::endl;
+			break;
+		}
+		pid_t pid = ::fork();
+		if (pid < 0) {
+			std::cerr << "Could not start render worker " << i << std::endl;
+			::close(fds[0]);
+			::close(fds[1]);
+			break;
+		}
+		if (pid == 0) {
+			::close(fds[0]);
+			for (const Worker& other : workers) {
+				::close(other.fd);
+			}
+			workerLoop(fds[1]);
+			::_exit(0);
+		}
+		::close(fds[1]);
+		Worker worker;
+		worker.pid = pid;
+		worker.fd = fds[0];
+		worker.lastProgress = FarmClock::now();
+		workers.push_back(worker);
+	}
+#else
+	if (numWorkers > 0) {
+		std::cerr << "Render workers are not supported on Windows; tracing locally" << std::endl;
+	}
+#endif
+}
+
+/**
+ * @fn	RenderFarm::~RenderFarm()
+ * @brief	Closes the sockets, which tells the workers to exit, and waits for them.
+ * 			Workers still busy with tiles that were finished elsewhere may be
+ * 			hung, so they are killed.
+ */
+
+RenderFarm::~RenderFarm() {
+#ifndef WINDOWS
+	for (Worker& worker : workers) {
+		if (worker.pid >= 0) {
+			::close(worker.fd);
+			if (!worker.inFlight.empty()) {
+				::kill(worker.pid, SIGKILL);
+			}
+		}
+	}
+	for (Worker& worker : workers) {
+		if (worker.pid >= 0) {
+			::waitpid(worker.pid, nullptr, 0);
+		}
+	}
+#endif
+}
+
+/**
+ * @fn	int RenderFarm::getNumWorkers() const
+ * @brief	Gets the number of workers still running.
+ * @return	The number of workers.
+ */
+
+int RenderFarm::getNumWorkers() const {
+	int count = 0;
+	for (const Worker& worker : workers) {
+		if (worker.pid >= 0) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * @fn	bool RenderFarm::render(FrameBuffer& frameBuffer, const std::atomic<bool>* cancel)
+ * @brief	Traces a frame with the workers. Produces the same image as
+ * 			RayTracer::raytraceScene does at full resolution, including accumulation
+ * 			into the framebuffer and the resolve.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	cancel	   	If not nullptr, set to true to abandon the frame.
+ * @return	True if the frame was finished, false if it was cancelled.
+ */
+
+bool RenderFarm::render(FrameBuffer& frameBuffer, const std::atomic<bool>* cancel) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int N = glm::max(rayTracer.antiAliasing, 1);
+	const int pass = frameBuffer.isAccumulating() ? frameBuffer.getAccumulatedPasses() : 0;
+	color colors[FARM_TILE_AREA];
+
+	drainWorkers();
+	frame++;
+	vector<FarmTileJob> tiles;
+	for (int y0 = 0; y0 < H; y0 += FARM_TILE_SIZE) {
+		for (int x0 = 0; x0 < W; x0 += FARM_TILE_SIZE) {
+			FarmTileJob job;
+			job.frame = frame;
+			job.id = (int)tiles.size();
+			job.x0 = x0;
+			job.y0 = y0;
+			job.w = glm::min(FARM_TILE_SIZE, W - x0);
+			job.h = glm::min(FARM_TILE_SIZE, H - y0);
+			job.pass = pass;
+			tiles.push_back(job);
+		}
+	}
+	vector<unsigned char> done(tiles.size(), 0);
+	vector<unsigned char> reissued(tiles.size(), 0);
+	std::deque<int> queue;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		queue.push_back((int)i);
+	}
+	size_t remaining = tiles.size();
+
+#ifndef WINDOWS
+	double totalSeconds = 0.0;
+	int timedTiles = 0;
+	vector<pollfd> fds;
+	vector<Worker*> polled;
+	while (remaining > 0 && getNumWorkers() > 0) {
+		if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+			return false;
+		}
+
+		// Keep every worker busy.
+		for (Worker& worker : workers) {
+			while (worker.pid >= 0 && worker.inFlight.size() < (size_t)FARM_TILES_IN_FLIGHT &&
+				!queue.empty()) {
+				int id = queue.front();
+				queue.pop_front();
+				if (!done[id] && !sendTile(worker, tiles[id])) {
+					queue.push_front(id);
+					removeWorker(worker, queue, done);
+				}
+			}
+		}
+
+		// Once nothing is waiting, give tiles that are taking far longer than
+		// average to an idle worker as well.
+		if (queue.empty() && timedTiles > 0) {
+			double limit = glm::max(FARM_STRAGGLER_FACTOR * totalSeconds / timedTiles,
+				FARM_STRAGGLER_SECONDS);
+			FarmClock::time_point now = FarmClock::now();
+			for (Worker& slow : workers) {
+				std::chrono::duration<double> elapsed = now - slow.lastProgress;
+				if (slow.pid < 0 || slow.inFlight.empty() || elapsed.count() < limit) {
+					continue;
+				}
+				for (int id : slow.inFlight) {
+					if (done[id] || reissued[id]) {
+						continue;
+					}
+					for (Worker& idle : workers) {
+						if (&idle != &slow && idle.pid >= 0 &&
+							idle.inFlight.size() < (size_t)FARM_TILES_IN_FLIGHT) {
+							reissued[id] = 1;
+							if (!sendTile(idle, tiles[id])) {
+								removeWorker(idle, queue, done);
+							}
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		fds.clear();
+		polled.clear();
+		for (Worker& worker : workers) {
+			if (worker.pid >= 0 && !worker.inFlight.empty()) {
+				pollfd p;
+				p.fd = worker.fd;
+				p.events = POLLIN;
+				p.revents = 0;
+				fds.push_back(p);
+				polled.push_back(&worker);
+			}
+		}
+		if (fds.empty()) {
+			continue;
+		}
+		if (::poll(fds.data(), fds.size(), FARM_POLL_MS) <= 0) {
+			continue;
+		}
+		for (size_t i = 0; i < fds.size(); i++) {
+			Worker& worker = *polled[i];
+			if (fds[i].revents & POLLIN) {
+				FarmTileJob job;
+				if (!readFully(worker.fd, &job, sizeof(job)) || job.id < 0 ||
+					job.id >= (int)tiles.size() || job.w * job.h > FARM_TILE_AREA ||
+					!readFully(worker.fd, colors, job.w * job.h * sizeof(color))) {
+					removeWorker(worker, queue, done);
+					continue;
+				}
+				FarmClock::time_point now = FarmClock::now();
+				std::chrono::duration<double> elapsed = now - worker.lastProgress;
+				worker.lastProgress = now;
+				if (!worker.inFlight.empty()) {
+					worker.inFlight.pop_front();
+				}
+				if (job.frame == frame && !done[job.id]) {
+					storeTile(frameBuffer, tiles[job.id], colors, N * N);
+					done[job.id] = 1;
+					remaining--;
+					totalSeconds += elapsed.count();
+					timedTiles++;
+				}
+			} else if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+				removeWorker(worker, queue, done);
+			}
+		}
+	}
+#endif
+
+	// Whatever the workers could not do is traced here.
+	for (size_t id = 0; id < tiles.size(); id++) {
+		if (done[id]) {
+			continue;
+		}
+		if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+			return false;
+		}
+		const FarmTileJob& job = tiles[id];
+		rayTracer.traceTile(scene, depth, job.x0, job.y0, job.w, job.h, job.pass, colors);
+		storeTile(frameBuffer, job, colors, N * N);
+		done[id] = 1;
+	}
+
+	if (frameBuffer.isAccumulating()) {
+		frameBuffer.resolveAccumBuffer();
+	}
+	return true;
+}
+
+/**
+ * @fn	int RenderFarm::renderFrames(int firstFrame, int lastFrame, int numWorkers,
+ *									const std::function<bool(int)>& renderFrame)
+ * @brief	Renders a range of whole frames in worker processes. The workers are
+ * 			forked, so they share one copy-on-write copy of the scene; whatever a
+ * 			worker changes to set up its frame is private to it. Each worker
+ * 			takes the next unclaimed frame until none are left. Frames that were
+ * 			not finished, because their worker died or renderFrame failed, are
+ * 			rendered again by the caller's process, as are all frames if there
+ * 			are no workers.
+ * @param	firstFrame 	The first frame number.
+ * @param	lastFrame  	The last frame number, inclusive.
+ * @param	numWorkers 	Number of worker processes.
+ * @param	renderFrame	Renders and saves one frame, given its number. Returns
+ * 						false if it failed.
+ * @return	The number of frames rendered.
+ */
+
+int RenderFarm::renderFrames(int firstFrame, int lastFrame, int numWorkers,
+	const std::function<bool(int)>& renderFrame) {
+	const int count = lastFrame - firstFrame + 1;
+	if (count <= 0) {
+		return 0;
+	}
+	vector<unsigned char> done(count, 0);
+#ifndef WINDOWS
+	// The next frame to claim, then a flag per frame, shared by all the workers.
+	const size_t sharedBytes = sizeof(std::atomic<int>) + count;
+	void* shared = numWorkers > 0 ? ::mmap(nullptr, sharedBytes, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+	if (numWorkers > 0 && shared == MAP_FAILED) {
+		std::cerr << "Could not share memory with render workers; rendering locally" << std::endl;
+	}
+	if (shared != MAP_FAILED) {
+		std::atomic<int>* nextFrame = new (shared) std::atomic<int>(0);
+		unsigned char* finished = static_cast<unsigned char*>(shared) + sizeof(std::atomic<int>);
+		std::cout.flush();
+		std::cerr.flush();
+		vector<pid_t> pids;
+		for (int i = 0; i < numWorkers; i++) {
+			pid_t pid = ::fork();
+			if (pid < 0) {
+				std::cerr << "Could not start render worker " << i << std::endl;
+				break;
+			}
+			if (pid == 0) {
+				int k;
+				while ((k = nextFrame->fetch_add(1)) < count) {
+					finished[k] = renderFrame(firstFrame + k) ? 1 : 0;
+				}
+				std::cout.flush();
+				::_exit(0);
+			}
+			pids.push_back(pid);
+		}
+		for (pid_t pid : pids) {
+			::waitpid(pid, nullptr, 0);
+		}
+		std::copy(finished, finished + count, done.begin());
+		::munmap(shared, sharedBytes);
+	}
+#else
+	if (numWorkers > 0) {
+		std::cerr << "Render workers are not supported on Windows; rendering locally" << std::endl;
+	}
+#endif
+	int rendered = 0;
+	for (int k = 0; k < count; k++) {
+		if (done[k] || renderFrame(firstFrame + k)) {
+			rendered++;
+		}
+	}
+	return rendered;
+}
+
+/**
+ * @fn	void RenderFarm::workerLoop(int fd) const
+ * @brief	Runs in a worker: traces each tile it is sent and sends back the
+ * 			colors, until the coordinator closes the socket.
+ * @param	fd	The worker's end of the socket.
+ */
+
+void RenderFarm::workerLoop(int fd) const {
+#ifndef WINDOWS
+	FarmTileJob job;
+	color colors[FARM_TILE_AREA];
+	while (readFully(fd, &job, sizeof(job))) {
+		if (job.w * job.h > FARM_TILE_AREA) {
+			break;
+		}
+		rayTracer.traceTile(scene, depth, job.x0, job.y0, job.w, job.h, job.pass, colors);
+		if (!writeFully(fd, &job, sizeof(job)) ||
+			!writeFully(fd, colors, job.w * job.h * sizeof(color))) {
+			break;
+		}
+	}
+	::close(fd);
+#endif
+}
+
+/**
+ * @fn	bool RenderFarm::sendTile(Worker& worker, const FarmTileJob& job)
+ * @brief	Sends a tile to a worker.
+ * @param [in,out]	worker	The worker.
+ * @param 		  	job   	The tile.
+ * @return	False if the worker could not be reached.
+ */
+
+bool RenderFarm::sendTile(Worker& worker, const FarmTileJob& job) {
+#ifndef WINDOWS
+	if (!writeFully(worker.fd, &job, sizeof(job))) {
+		return false;
+	}
+	if (worker.inFlight.empty()) {
+		worker.lastProgress = FarmClock::now();
+	}
+	worker.inFlight.push_back(job.id);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @fn	void RenderFarm::removeWorker(Worker& worker, std::deque<int>& queue,
+ *									const vector<unsigned char>& done)
+ * @brief	Stops a worker that died or misbehaved, and puts its unfinished tiles
+ * 			back at the front of the queue.
+ * @param [in,out]	worker	The worker.
+ * @param [in,out]	queue 	Tiles waiting to be sent.
+ * @param 		  	done  	Nonzero for the tiles already in the framebuffer.
+ */
+
+void RenderFarm::removeWorker(Worker& worker, std::deque<int>& queue,
+	const vector<unsigned char>& done) {
+#ifndef WINDOWS
+	std::cerr << "Render worker " << worker.pid << " stopped; reissuing its "
+		<< worker.inFlight.size() << " tiles" << std::endl;
+	::kill(worker.pid, SIGKILL);
+	::close(worker.fd);
+	::waitpid(worker.pid, nullptr, 0);
+#endif
+	for (auto it = worker.inFlight.rbegin(); it != worker.inFlight.rend(); ++it) {
+		if (!done[*it]) {
+			queue.push_front(*it);
+		}
+	}
+	worker.inFlight.clear();
+	worker.pid = -1;
+}
+
+/**
+ * @fn	void RenderFarm::drainWorkers()
+ * @brief	Throws away the results of tiles still in flight from an earlier
+ * 			frame, which was cancelled or finished without them, so the workers
+ * 			are idle before the next one starts. A worker that takes longer than
+ * 			FARM_DRAIN_MS to answer is assumed to be hung, and is stopped.
+ */
+
+void RenderFarm::drainWorkers() {
+#ifndef WINDOWS
+	std::deque<int> unused;
+	vector<unsigned char> done;
+	color colors[FARM_TILE_AREA];
+	for (Worker& worker : workers) {
+		while (worker.pid >= 0 && !worker.inFlight.empty()) {
+			pollfd p;
+			p.fd = worker.fd;
+			p.events = POLLIN;
+			p.revents = 0;
+			FarmTileJob job;
+			if (::poll(&p, 1, FARM_DRAIN_MS) <= 0 || !readFully(worker.fd, &job, sizeof(job)) ||
+				job.w * job.h > FARM_TILE_AREA ||
+				!readFully(worker.fd, colors, job.w * job.h * sizeof(color))) {
+				worker.inFlight.clear();
+				removeWorker(worker, unused, done);
+				break;
+			}
+			worker.inFlight.pop_front();
+		}
+	}
+#endif
+}
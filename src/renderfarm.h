@@ -0,0 +1,86 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include "defs.h"
+#include "framebuffer.h"
+#include "raytracer.h"
+#include "iscene.h"
+
+const int FARM_TILE_SIZE = 32;				//!< Farm tiles are 32x32 pixels, 4x4 framebuffer tiles.
+const int FARM_TILE_AREA = FARM_TILE_SIZE * FARM_TILE_SIZE;
+const int FARM_TILES_IN_FLIGHT = 2;			//!< Tiles queued at each worker, to hide the round trip.
+const double FARM_STRAGGLER_FACTOR = 4.0;	//!< A tile this many times slower than average is reissued.
+const double FARM_STRAGGLER_SECONDS = 0.25;	//!< ... but only once it has taken this long.
+const int FARM_POLL_MS = 20;				//!< How often the coordinator checks for stragglers.
+const int FARM_DRAIN_MS = 2000;				//!< How long a worker may take to finish an old frame's tile.
+
+/**
+ * @struct	FarmTileJob
+ * @brief	A tile sent to a worker. The worker sends it back, followed by
+ * 			w * h colors.
+ */
+
+struct FarmTileJob {
+	int frame;			//!< Which render() call the tile belongs to.
+	int id;				//!< Index of the tile in the frame.
+	int x0, y0;			//!< Lower left pixel of the tile.
+	int w, h;			//!< Size of the tile.
+	int pass;			//!< Number of passes already accumulated, for the sample jitter.
+};
+
+/**
+ * @struct	RenderFarm
+ * @brief	Ray traces frames with several worker processes. The workers are
+ * 			forked when the farm is made, so each starts with a copy-on-write
+ * 			copy of the ray tracer, scene and camera, and nothing needs to be
+ * 			serialized. A coordinator hands out tiles over Unix sockets,
+ * 			gathers the colors into the framebuffer, and hands the tiles of a
+ * 			worker that dies to the others. Near the end of a frame, tiles that
+ * 			take much longer than average are also given to an idle worker, and
+ * 			whichever copy finishes first is used. If every worker is gone, the
+ * 			coordinator traces the rest itself. Only full resolution tiles are
+ * 			traced (see RayTracer::traceTile). On Windows, which cannot fork,
+ * 			the farm has no workers. renderFrames instead hands whole frames of
+ * 			an animation to workers.
+ */
+
+struct RenderFarm {
+	RenderFarm(const RayTracer& rayTracer, const IScene& theScene, int depth, int numWorkers);
+	~RenderFarm();
+	int getNumWorkers() const;
+	bool render(FrameBuffer& frameBuffer, const std::atomic<bool>* cancel = nullptr);
+	static int renderFrames(int firstFrame, int lastFrame, int numWorkers,
+		const std::function<bool(int)>& renderFrame);
+protected:
+	/**
+	 * @struct	Worker
+	 * @brief	The coordinator's view of a worker process.
+	 */
+	struct Worker {
+		int pid;						//!< Process id, or -1 once it is gone
+		int fd;							//!< Coordinator's end of the socket
+		std::deque<int> inFlight;		//!< Ids of the tiles sent and not yet returned
+		std::chrono::steady_clock::time_point lastProgress;	//!< When it last sent or returned a tile
+	};
+	const RayTracer& rayTracer;			//!< The ray tracer, as it was when the workers forked
+	const IScene& scene;				//!< The scene, as it was when the workers forked
+	int depth;							//!< Recursion depth
+	int frame;							//!< Number of render() calls
+	vector<Worker> workers;				//!< The workers
+	void workerLoop(int fd) const;
+	bool sendTile(Worker& worker, const FarmTileJob& job);
+	void removeWorker(Worker& worker, std::deque<int>& queue, const vector<unsigned char>& done);
+	void drainWorkers();
+};
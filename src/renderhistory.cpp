@@ -0,0 +1,249 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "renderhistory.h"
+
+/**
+ * @fn	RenderHistory::RenderHistory()
+ * @brief	Constructs an empty history.
+ */
+
+RenderHistory::RenderHistory()
+	: camera(nullptr), width(0), height(0), frameCount(0), transparentMoved(false) {
+}
+
+/**
+ * @fn	RenderHistory::~RenderHistory()
+ * @brief	Destructor.
+ */
+
+RenderHistory::~RenderHistory() {
+	delete camera;
+}
+
+/**
+ * @fn	void RenderHistory::clear()
+ * @brief	Forgets the previous frame, so nothing reprojects.
+ */
+
+void RenderHistory::clear() {
+	delete camera;
+	camera = nullptr;
+	samples.clear();
+	transparentMoved = false;
+}
+
+/**
+ * @fn	void RenderHistory::store(const RaytracingCamera& frameCamera, int width, int height,
+ *									const vector<GBufferSample>& frameSamples)
+ * @brief	Remembers a finished frame.
+ * @param	frameCamera 	The camera of the frame.
+ * @param	width			Width of the frame.
+ * @param	height			Height of the frame.
+ * @param	frameSamples	width * height samples, row-major, bottom row first.
+ */
+
+void RenderHistory::store(const RaytracingCamera& frameCamera, int width, int height,
+	const vector<GBufferSample>& frameSamples) {
+	delete camera;
+	camera = frameCamera.clone();
+	this->width = width;
+	this->height = height;
+	samples = frameSamples;
+	frameCount++;
+	transparentMoved = false;
+}
+
+/**
+ * @fn	static bool sameSurface(const GBufferSample& sample, const GBufferSample& pixel)
+ * @brief	Decides if a previous sample saw the surface a pixel sees now. It did
+ * 			not if the surface was occluded then, or has moved.
+ * @param	sample	The previous sample.
+ * @param	pixel 	Position and normal the pixel sees now.
+ * @return	True if both saw the same surface.
+ */
+
+static bool sameSurface(const GBufferSample& sample, const GBufferSample& pixel) {
+	return sample.depth != FLT_MAX &&
+		glm::distance(sample.position, pixel.position) <= HISTORY_POSITION_TOLERANCE * pixel.depth &&
+		glm::dot(sample.normal, pixel.normal) >= HISTORY_MIN_COSINE;
+}
+
+/**
+ * @fn	static dvec3 reflectedPoint(const GBufferSample& sample)
+ * @brief	The virtual point a reflection appears to come from: the reflected
+ * 			ray's hit, as if it were straight ahead, behind the mirror. In a
+ * 			mirror, the reflection moves with this point, not with the surface.
+ * @param	sample	A sample whose reflected ray hit something.
+ * @return	The virtual point.
+ */
+
+static dvec3 reflectedPoint(const GBufferSample& sample) {
+	return sample.position + sample.reflectionDepth * sample.direction;
+}
+
+/**
+ * @fn	int RenderHistory::gatherTaps(const dvec3& point, const GBufferSample* taps[4],
+ *									double weights[4]) const
+ * @brief	Finds the four previous samples around where a point appeared in the
+ * 			previous frame, and their bilinear weights.
+ * @param 		  	point  	The point, in world coordinates.
+ * @param [out]	  	taps   	The samples that are in the frame.
+ * @param [out]	  	weights	Their bilinear weights.
+ * @return	The number of taps, 0 if the point was off screen.
+ */
+
+int RenderHistory::gatherTaps(const dvec3& point, const GBufferSample* taps[4],
+	double weights[4]) const {
+	dvec2 prev;
+	if (camera == nullptr || !camera->getPixelCoords(point, prev)) {
+		return 0;
+	}
+	int x0 = (int)std::floor(prev.x);
+	int y0 = (int)std::floor(prev.y);
+	double fx = prev.x - x0;
+	double fy = prev.y - y0;
+	int numTaps = 0;
+	for (int j = 0; j <= 1; j++) {
+		for (int i = 0; i <= 1; i++) {
+			int x = x0 + i;
+			int y = y0 + j;
+			if (x < 0 || x >= width || y < 0 || y >= height) {
+				continue;
+			}
+			taps[numTaps] = &samples[y * width + x];
+			weights[numTaps] = (i == 0 ? 1.0 - fx : fx) * (j == 0 ? 1.0 - fy : fy);
+			numTaps++;
+		}
+	}
+	return numTaps;
+}
+
+/**
+ * @fn	bool RenderHistory::reproject(const GBufferSample& pixel, color& C) const
+ * @brief	Looks up the previous frame's color of the surface a pixel sees now,
+ * 			blending the samples around it that saw the same surface. If the
+ * 			transparent objects have moved, a sample is only used if its primary
+ * 			ray passed one exactly when the pixel's does: a transparent object's
+ * 			tint does not depend on where it is hit. Changes in the reflection
+ * 			are left to the caller, which clamps the color to its neighbors.
+ * @param 		  	pixel	Position and normal the pixel sees now.
+ * @param [out]	  	C	 	The previous color, if found.
+ * @return	True if the history had the surface.
+ */
+
+bool RenderHistory::reproject(const GBufferSample& pixel, color& C) const {
+	const GBufferSample* taps[4];
+	double weights[4];
+	if (pixel.depth == FLT_MAX) {
+		return false;
+	}
+	int numTaps = gatherTaps(pixel.position, taps, weights);
+	color total_c;
+	double totalWeight = 0.0;
+	for (int i = 0; i < numTaps; i++) {
+		if (sameSurface(*taps[i], pixel) &&
+			!(transparentMoved && taps[i]->throughTransparent != pixel.throughTransparent)) {
+			total_c += weights[i] * taps[i]->C;
+			totalWeight += weights[i];
+		}
+	}
+	if (totalWeight <= EPSILON) {
+		return false;
+	}
+	C = total_c / totalWeight;
+	return true;
+}
+
+/**
+ * @fn	bool RenderHistory::reprojectSecondary(const GBufferSample& pixel, int numLights,
+ *												GBufferSample& secondary) const
+ * @brief	Looks up the previous frame's shadow and reflection results for the
+ * 			surface a pixel sees now. Only samples that traced their secondary
+ * 			rays are used. Shadows are found where the surface was. Reflections
+ * 			are found where the reflected point was (see reflectedPoint), among
+ * 			samples whose reflections came from that point. If the transparent
+ * 			objects have moved, samples whose reflected rays passed through one
+ * 			are not used, since it is not known if the pixel's does now.
+ * @param 		  	pixel	 	Position, normal and direction of the pixel's ray now.
+ * @param 		  	numLights	Number of lights in the scene.
+ * @param [out]	  	secondary	Gets the visibility and reflection, if found.
+ * @return	True if the history had them.
+ */
+
+bool RenderHistory::reprojectSecondary(const GBufferSample& pixel, int numLights,
+	GBufferSample& secondary) const {
+	const GBufferSample* taps[4];
+	double weights[4];
+	if (numLights > MAX_CACHED_LIGHTS || pixel.depth == FLT_MAX) {
+		return false;
+	}
+	int numTaps = gatherTaps(pixel.position, taps, weights);
+	double totalWeight = 0.0;
+	double reflectionWeight = 0.0;
+	secondary.reflection = black;
+	secondary.reflectionDepth = 0.0;
+	secondary.reflectionThroughTransparent = false;
+	for (int l = 0; l < numLights; l++) {
+		secondary.visibility[l] = 0.0;
+	}
+	for (int i = 0; i < numTaps; i++) {
+		if (!taps[i]->hasSecondary || !sameSurface(*taps[i], pixel) ||
+			(transparentMoved && taps[i]->reflectionThroughTransparent)) {
+			continue;
+		}
+		secondary.reflectionThroughTransparent |= taps[i]->reflectionThroughTransparent;
+		for (int l = 0; l < numLights; l++) {
+			secondary.visibility[l] += weights[i] * taps[i]->visibility[l];
+		}
+		secondary.reflection += weights[i] * taps[i]->reflection;
+		totalWeight += weights[i];
+		if (taps[i]->reflectionDepth != FLT_MAX) {
+			secondary.reflectionDepth += weights[i] * taps[i]->reflectionDepth;
+			reflectionWeight += weights[i];
+		}
+	}
+	if (totalWeight <= EPSILON) {
+		return false;
+	}
+	for (int l = 0; l < numLights; l++) {
+		secondary.visibility[l] /= totalWeight;
+	}
+	secondary.reflection /= totalWeight;
+	if (reflectionWeight <= EPSILON) {
+		// Reflects nothing but the background, which is the same from anywhere
+		secondary.reflectionDepth = FLT_MAX;
+		return true;
+	}
+
+	secondary.position = pixel.position;
+	secondary.direction = pixel.direction;
+	secondary.reflectionDepth /= reflectionWeight;
+	dvec3 virtualPt = reflectedPoint(secondary);
+	double tolerance = HISTORY_POSITION_TOLERANCE * (pixel.depth + secondary.reflectionDepth);
+	numTaps = gatherTaps(virtualPt, taps, weights);
+	color total_c;
+	totalWeight = 0.0;
+	for (int i = 0; i < numTaps; i++) {
+		if (!taps[i]->hasSecondary || taps[i]->reflectionDepth == FLT_MAX ||
+			(transparentMoved && taps[i]->reflectionThroughTransparent)) {
+			continue;
+		}
+		if (glm::distance(reflectedPoint(*taps[i]), virtualPt) <= tolerance) {
+			total_c += weights[i] * taps[i]->reflection;
+			totalWeight += weights[i];
+			secondary.reflectionThroughTransparent |= taps[i]->reflectionThroughTransparent;
+		}
+	}
+	if (totalWeight <= EPSILON) {
+		return false;
+	}
+	secondary.reflection = total_c / totalWeight;
+	return true;
+}
@@ -0,0 +1,73 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "camera.h"
+
+const double HISTORY_POSITION_TOLERANCE = 0.02;	//!< Reprojection tolerance, relative to depth.
+const double HISTORY_MIN_COSINE = 0.9;			//!< Normals must be this close to reproject.
+const int MAX_CACHED_LIGHTS = 4;				//!< Shadows are cached for scenes with up to this many lights.
+const int SECONDARY_REFRESH_FRAMES = 8;			//!< Cached secondary rays are retraced this often.
+
+/**
+ * @struct	GBufferSample
+ * @brief	A shaded sample, and the depth, position and normal of its primary
+ * 			hit. Used to upsample and reconstruct frames without blurring across
+ * 			edges. If the sample was fully traced, it also keeps the results of
+ * 			its secondary rays, so the next frame can reuse them.
+ */
+
+struct GBufferSample {
+	color C;				//!< the shaded color.
+	double depth;			//!< distance to the primary hit, FLT_MAX if the ray missed.
+	dvec3 position;			//!< the primary hit, in world coordinates.
+	dvec3 normal;			//!< normal at the primary hit.
+	color albedo;			//!< diffuse color at the primary hit, blended with its texture.
+	double variance;		//!< estimated variance of C, per channel.
+	dvec3 direction;		//!< direction of the primary ray.
+	bool throughTransparent;	//!< true if the primary ray passed a transparent object before its hit.
+	bool hasSecondary;		//!< true if visibility and reflection are set.
+	double visibility[MAX_CACHED_LIGHTS];	//!< fraction of each light that is not shadowed.
+	color reflection;		//!< color seen by the reflected ray.
+	double reflectionDepth;	//!< distance the reflected ray went, FLT_MAX if it missed.
+	bool reflectionThroughTransparent;	//!< true if the reflected ray, or one reflected from it, passed a transparent object.
+};
+
+/**
+ * @struct	RenderHistory
+ * @brief	The samples of the previous ray traced frame and the camera that saw
+ * 			them. A point seen in the current frame is reprojected into the
+ * 			previous one to reuse its shading, or the results of its shadow and
+ * 			reflection rays, if the same surface was visible there. When the
+ * 			transparent objects have moved since, samples that may have changed
+ * 			because of it are not reused.
+ */
+
+struct RenderHistory {
+	RenderHistory();
+	~RenderHistory();
+	void clear();
+	bool isValid() const { return camera != nullptr; }
+	void markTransparentMoved() { transparentMoved = true; }
+	int getFrameCount() const { return frameCount; }
+	void store(const RaytracingCamera& frameCamera, int width, int height,
+		const vector<GBufferSample>& frameSamples);
+	bool reproject(const GBufferSample& pixel, color& C) const;
+	bool reprojectSecondary(const GBufferSample& pixel, int numLights, GBufferSample& secondary) const;
+protected:
+	int gatherTaps(const dvec3& point, const GBufferSample* taps[4], double weights[4]) const;
+	RaytracingCamera* camera;		//!< Camera of the previous frame, or nullptr
+	int width;						//!< Width of the previous frame
+	int height;						//!< Height of the previous frame
+	int frameCount;					//!< Frames stored since construction
+	bool transparentMoved;			//!< True if transparent objects moved since the frame was stored
+	vector<GBufferSample> samples;	//!< width * height samples, row-major, bottom row first
+};
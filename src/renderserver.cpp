@@ -0,0 +1,231 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <chrono>
+#include <sstream>
+#include "renderserver.h"
+#include "framebuffer.h"
+#include "camera.h"
+
+#ifndef WINDOWS
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @fn	RenderServer::RenderServer(const color& defaultColor)
+ * @brief	Constructs a server with no scenes.
+ * @param	defaultColor	Color of rays that hit nothing.
+ */
+
+RenderServer::RenderServer(const color& defaultColor)
+	: rayTracer(defaultColor), requestsServed(0) {
+}
+
+/**
+ * @fn	void RenderServer::addScene(const std::string& id, IScene* scene)
+ * @brief	Makes a scene available to requests. The scene must outlive the
+ * 			server. Its camera is replaced by each request's.
+ * @param	id   	The name requests use for the scene.
+ * @param	scene	The scene.
+ */
+
+void RenderServer::addScene(const std::string& id, IScene* scene) {
+	scenes[id] = scene;
+}
+
+#ifndef WINDOWS
+
+/**
+ * @fn	static bool writeFully(int fd, const void* data, size_t size)
+ * @brief	Writes exactly size bytes to a socket.
+ * @param	fd  	The socket.
+ * @param	data	The bytes.
+ * @param	size	Number of bytes.
+ * @return	False if the client went away.
+ */
+
+static bool writeFully(int fd, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t n = ::send(fd, p, size, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+#endif
+
+/**
+ * @fn	bool RenderServer::run(const std::string& socketPath)
+ * @brief	Serves requests until one says "quit". Replaces any file already at
+ * 			socketPath, and removes it when done.
+ * @param	socketPath	Where to make the socket.
+ * @return	False if the socket could not be made.
+ */
+
+bool RenderServer::run(const std::string& socketPath) {
+#ifndef WINDOWS
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path is too long: " << socketPath << endl;
+		return false;
+	}
+	socketPath.copy(address.sun_path, socketPath.size());
+	int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	::unlink(socketPath.c_str());
+	if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+		::listen(listener, 8) != 0) {
+		std::cerr << "Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+		if (listener >= 0) {
+			::close(listener);
+		}
+		return false;
+	}
+	// A client that hangs up early must not kill the server.
+	::signal(SIGPIPE, SIG_IGN);
+	cout << "Serving " << scenes.size() << " scene(s) on " << socketPath << endl;
+
+	bool quit = false;
+	while (!quit) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "accept failed: " << strerror(errno) << endl;
+			break;
+		}
+		quit = serveConnection(fd);
+		::close(fd);
+	}
+	::close(listener);
+	::unlink(socketPath.c_str());
+	return true;
+#else
+	std::cerr << "The render server needs Unix domain sockets, which this build does not support" << endl;
+	return false;
+#endif
+}
+
+/**
+ * @fn	bool RenderServer::serveConnection(int fd)
+ * @brief	Answers the requests on one connection, until the client closes it.
+ * @param	fd	The connection.
+ * @return	True if the client asked the server to quit.
+ */
+
+bool RenderServer::serveConnection(int fd) {
+#ifndef WINDOWS
+	std::string pending;
+	char buffer[1024];
+	while (true) {
+		size_t end = pending.find('\n');
+		if (end == std::string::npos) {
+			if (pending.size() > SERVER_MAX_LINE) {
+				const char* error = "ERROR request too long\n";
+				writeFully(fd, error, strlen(error));
+				return false;
+			}
+			ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				return false;
+			}
+			pending.append(buffer, n);
+			continue;
+		}
+		std::string request = pending.substr(0, end);
+		pending.erase(0, end + 1);
+		if (!request.empty() && request.back() == '\r') {
+			request.pop_back();
+		}
+		if (request == "quit") {
+			return true;
+		}
+		std::string image;
+		std::string reply = handleRequest(request, image);
+		if (!writeFully(fd, reply.data(), reply.size()) ||
+			!writeFully(fd, image.data(), image.size())) {
+			return false;
+		}
+	}
+#else
+	return false;
+#endif
+}
+
+/**
+ * @fn	std::string RenderServer::handleRequest(const std::string& request, std::string& image)
+ * @brief	Renders one request, and reports its latency on cout.
+ * @param 	  	request	The request line, without its newline.
+ * @param [out]	image  	The encoded image, or empty if the request failed.
+ * @return	The reply's first line, with its newline.
+ */
+
+std::string RenderServer::handleRequest(const std::string& request, std::string& image) {
+	auto startTime = std::chrono::steady_clock::now();
+	std::istringstream fields(request);
+	std::string command, sceneId, extra;
+	int width, height, aa, reflections, shadows;
+	dvec3 eye, focus, up;
+	double fovDegrees;
+	fields >> command >> sceneId >> width >> height >> aa >> reflections >> shadows
+		>> eye.x >> eye.y >> eye.z >> focus.x >> focus.y >> focus.z
+		>> up.x >> up.y >> up.z >> fovDegrees;
+	if (!fields || command != "render" || (fields >> extra)) {
+		return "ERROR expected: render SCENE WIDTH HEIGHT AA REFLECTIONS SHADOWS "
+			"EX EY EZ FX FY FZ UX UY UZ FOV\n";
+	}
+	auto scene = scenes.find(sceneId);
+	if (scene == scenes.end()) {
+		return "ERROR unknown scene " + sceneId + "\n";
+	}
+	if (width < 1 || width > SERVER_MAX_SIZE || height < 1 || height > SERVER_MAX_SIZE ||
+		aa < 1 || aa > SERVER_MAX_ANTIALIASING || reflections < 0 || reflections > SERVER_MAX_REFLECTIONS ||
+		shadows < 0 || shadows > SERVER_MAX_SHADOW_SAMPLES || fovDegrees <= 0.0 || fovDegrees >= 180.0 ||
+		glm::length(glm::cross(focus - eye, up)) < EPSILON) {
+		return "ERROR parameter out of range\n";
+	}
+
+	PerspectiveCamera camera(eye, focus, up, glm::radians(fovDegrees), width, height);
+	IScene& theScene = *scene->second;
+	RaytracingCamera* oldCamera = theScene.camera;
+	theScene.camera = &camera;
+	rayTracer.antiAliasing = aa;
+	rayTracer.shadowSamples = shadows;
+	FrameBuffer frameBuffer(width, height);
+	rayTracer.raytraceScene(frameBuffer, reflections, theScene);
+	theScene.camera = oldCamera;
+	std::ostringstream encoded;
+	frameBuffer.writeColorBuffer(encoded);
+	image = encoded.str();
+
+	double ms = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	requestsServed++;
+	cout << "Request " << requestsServed << ": " << sceneId << " " << width << "x" << height
+		<< ", " << ms << " ms" << endl;
+	std::ostringstream reply;
+	reply << "OK " << width << " " << height << " " << image.size() << " " << ms << "\n";
+	return reply.str();
+}
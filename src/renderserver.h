@@ -0,0 +1,52 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <map>
+#include "defs.h"
+#include "raytracer.h"
+#include "iscene.h"
+
+const int SERVER_MAX_SIZE = 8192;			//!< Largest image width or height served.
+const int SERVER_MAX_ANTIALIASING = 8;		//!< Most samples per pixel along each axis.
+const int SERVER_MAX_REFLECTIONS = 16;		//!< Deepest recursion served.
+const int SERVER_MAX_SHADOW_SAMPLES = 256;	//!< Most shadow feelers per light.
+const size_t SERVER_MAX_LINE = 4096;		//!< Longest request line.
+
+/**
+ * @struct	RenderServer
+ * @brief	Ray traces images on request, for as long as it runs, so scenes and
+ * 			their textures are built and loaded once rather than by every render.
+ * 			Requests arrive over a local (Unix domain) socket, one line each:
+ *
+ * 			render SCENE WIDTH HEIGHT AA REFLECTIONS SHADOWS EX EY EZ FX FY FZ UX UY UZ FOV
+ *
+ * 			renders the scene registered as SCENE from a perspective camera at
+ * 			(EX, EY, EZ), looking at (FX, FY, FZ), with up vector (UX, UY, UZ)
+ * 			and a field of view of FOV degrees. AA, REFLECTIONS and SHADOWS are
+ * 			the antialiasing, recursion depth and shadow feelers per light. The
+ * 			reply is "OK WIDTH HEIGHT BYTES MILLISECONDS", a newline and a binary
+ * 			PPM image of BYTES bytes; MILLISECONDS is the request's latency, from
+ * 			reading it to encoding the image. A bad request gets "ERROR message".
+ * 			"quit" stops the server. Several requests can share a connection,
+ * 			and connections are served one at a time.
+ */
+
+struct RenderServer {
+	RenderServer(const color& defaultColor);
+	void addScene(const std::string& id, IScene* scene);
+	bool run(const std::string& socketPath);
+protected:
+	bool serveConnection(int fd);
+	std::string handleRequest(const std::string& request, std::string& image);
+	RayTracer rayTracer;						//!< Traces every request
+	std::map<std::string, IScene*> scenes;		//!< The resident scenes, by id
+	int requestsServed;							//!< Number of requests answered
+};
@@ -0,0 +1,123 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * PLEASE NOTE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "threadpool.h"
+
+/**
+ * @fn	ThreadPool::ThreadPool(int numThreads)
+ * @brief	Starts numThreads - 1 worker threads.
+ * @param	numThreads	Threads to run loops on, counting the caller.
+ */
+
+ThreadPool::ThreadPool(int numThreads)
+	: iteration(nullptr), body(nullptr), count(0), next(0), generation(0), busyWorkers(0), stopping(false) {
+	for (int i = 1; i < numThreads; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+/**
+ * @fn	ThreadPool::~ThreadPool()
+ * @brief	Stops the workers.
+ */
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * @fn	ThreadPool& ThreadPool::shared()
+ * @brief	Gets a pool with one thread per core, made on first use.
+ * @return	The pool.
+ */
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+/**
+ * @fn	void ThreadPool::run(int count, Iteration iteration, const void* body)
+ * @brief	Runs a loop for parallelFor. If the workers are busy with another
+ * 			caller's loop, this one is run on the calling thread instead.
+ * @param	count	 	Number of iterations.
+ * @param	iteration	Calls the body for one iteration.
+ * @param	body	 	The loop body.
+ */
+
+void ThreadPool::run(int count, Iteration iteration, const void* body) {
+	if (count <= 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> loop(loopMutex, std::defer_lock);
+	if (workers.empty() || count == 1 || !loop.try_lock()) {
+		for (int i = 0; i < count; i++) {
+			iteration(body, i);
+		}
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->iteration = iteration;
+		this->body = body;
+		this->count = count;
+		next = 0;
+		busyWorkers = (int)workers.size();
+		generation++;
+	}
+	workReady.notify_all();
+	runIterations();
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [this] { return busyWorkers == 0; });
+	this->body = nullptr;
+}
+
+/**
+ * @fn	void ThreadPool::runIterations()
+ * @brief	Runs iterations of the current loop until none are left.
+ */
+
+void ThreadPool::runIterations() {
+	int i;
+	while ((i = next.fetch_add(1)) < count) {
+		iteration(body, i);
+	}
+}
+
+/**
+ * @fn	void ThreadPool::workerLoop()
+ * @brief	Body of a worker thread: helps with each loop as it starts.
+ */
+
+void ThreadPool::workerLoop() {
+	int seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [this, seen] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		runIterations();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+		}
+		workDone.notify_one();
+	}
+}
@@ -0,0 +1,65 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "defs.h"
+
+/**
+ * @struct	ThreadPool
+ * @brief	A fixed set of worker threads that run the iterations of a loop in
+ * 			parallel. The thread that calls parallelFor works too, so a pool of
+ * 			N threads has N - 1 workers. One loop runs at a time; a loop started
+ * 			while another is running, from another thread or from inside a loop
+ * 			body, runs on its caller alone.
+ */
+
+struct ThreadPool {
+	ThreadPool(int numThreads = (int)std::thread::hardware_concurrency());
+	~ThreadPool();
+	int getNumThreads() const { return (int)workers.size() + 1; }
+	template <class Body> void parallelFor(int count, const Body& body);
+	static ThreadPool& shared();
+protected:
+	typedef void (*Iteration)(const void* body, int i);	//!< Calls a loop body
+	void run(int count, Iteration iteration, const void* body);
+	void workerLoop();
+	void runIterations();
+	vector<std::thread> workers;				//!< The worker threads
+	std::mutex loopMutex;						//!< Held by the caller whose loop the workers run
+	std::mutex mutex;							//!< Guards the fields below, except next
+	std::condition_variable workReady;			//!< Signalled when a loop starts or the pool stops
+	std::condition_variable workDone;			//!< Signalled when a worker finishes its part of a loop
+	Iteration iteration;						//!< Calls the current loop's body
+	const void* body;							//!< The current loop's body
+	int count;									//!< The current loop's number of iterations
+	std::atomic<int> next;						//!< Next iteration to run
+	int generation;								//!< Number of loops started
+	int busyWorkers;							//!< Workers still working on the current loop
+	bool stopping;								//!< True when the pool is being destroyed
+};
+
+/**
+ * @fn	template <class Body> void ThreadPool::parallelFor(int count, const Body& body)
+ * @brief	Calls body(0), ..., body(count - 1), in parallel and in no
+ * 			particular order, and returns when all of them have returned. The
+ * 			body is called through a function pointer, so nothing is allocated.
+ * @tparam	Body	Anything that can be called with an int.
+ * @param	count	Number of iterations.
+ * @param	body 	The loop body.
+ */
+
+template <class Body>
+void ThreadPool::parallelFor(int count, const Body& body) {
+	run(count, [](const void* body, int i) { (*(const Body*)body)(i); }, &body);
+}
@@ -13,26 +13,24 @@
 
  /**
   * @struct	VertexData
-  * @brief	A vertex data. Used for Pipeline graphics.
+  * @brief	A vertex data. Used for Pipeline graphics. Vertices carry no
+  * 			material; it is bound to each triangle, or to a whole draw call.
   */
 
 struct VertexData {
-	dvec4 pos;			//!< Processed coordinate.
+	dvec4 pos;			//!< Processed coordinate. Once divided, w holds 1/w.
 	dvec3 normal;		//!< transformed normal vector.
 	dvec3 worldPos;		//!< Saved world position, for lighting calculations.
-	Material material;	//!< This vertex's material.
 
-	VertexData(const dvec4& pos, const dvec3& norm,
-		const Material& mat, const dvec3& worldPos);
-	VertexData(const dvec4& pos) : VertexData(pos, Z_AXIS, bronze, ORIGIN3D) {
+	VertexData(const dvec4& pos, const dvec3& norm, const dvec3& worldPos);
+	VertexData(const dvec4& pos) : VertexData(pos, Z_AXIS, ORIGIN3D) {
 	}
-	VertexData(const dvec4& pos, const dvec3& norm, const Material& mat) :
-		VertexData(pos, norm, mat, ORIGIN3D) {
+	VertexData(const dvec4& pos, const dvec3& norm) :
+		VertexData(pos, norm, ORIGIN3D) {
 	}
 	VertexData(double w1, const VertexData& vd1, double w2, const VertexData& vd2);
 	static void addTriVertsAndComputeNormal(vector<VertexData>& verts,
-		const dvec4& V1, const dvec4& V2, const dvec4& V3,
-		const Material& mat);
+		const dvec4& V1, const dvec4& V2, const dvec4& V3);
 	VertexData operator + (const VertexData& other) const;
 };
 
@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include "defs.h"
 #include "vertexops.h"
 
@@ -20,90 +21,110 @@ vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1,
 	//												IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1))
 };
 
+thread_local PipelineBuffers VertexOps::buffers;
+
 /**
- * @fn	vector<VertexData> triangulate(const vector<VertexData> &poly)
- * @brief	Triangulates the given polygon
- * @param	poly	The polygon to be decomposed into individual triangles.
- * @return	A vector of triangles, which comprise the original polygon.
+ * @fn	static VertexData interpolateClipped(const VertexData& v0, const VertexData& v1, double t)
+ * @brief	Makes the vertex where an edge leaves a clipping plane. Positions are
+ * 			interpolated linearly, and so is 1/w, which pos.w holds once the
+ * 			position has been divided. The other attributes are only linear in
+ * 			t after they are divided by w, so their weight is corrected. Before
+ * 			projection w is 1, and the correction does nothing.
+ * @param	v0	The first end of the edge.
+ * @param	v1	The second end of the edge.
+ * @param	t 	Where the plane crosses the edge, from 0 at v0 to 1 at v1.
+ * @return	The vertex on the plane.
  */
 
-vector<VertexData> triangulate(const vector<VertexData>& poly) {
-	vector<VertexData> triangles;
-
-	for (unsigned int i = 1; i < poly.size() - 1; i++) {
-		triangles.push_back(poly[0]);
-		triangles.push_back(poly[i]);
-		triangles.push_back(poly[i + 1]);
-	}
-
-	return triangles;
+static VertexData interpolateClipped(const VertexData& v0, const VertexData& v1, double t) {
+	double s = t * v1.pos.w / glm::mix(v0.pos.w, v1.pos.w, t);
+	VertexData clipped(1.0 - s, v0, s, v1);
+	clipped.pos = glm::mix(v0.pos, v1.pos, t);
+	return clipped;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane)
+ * @fn	void VertexOps::clipAgainstPlane(const vector<VertexData>& verts, const IPlane& plane,
+ *										vector<VertexData>& output)
  * @brief	Clips a polygon against a single plane
- * @param [in,out]	verts	The array of vertices.
- * @param 		  	plane	The plane that will do the clipping.
- * @return	The polygon that exludes the portions outside the given plane.
+ * @param 		  	verts 	The array of vertices.
+ * @param 		  	plane 	The plane that will do the clipping.
+ * @param [out]		output	The polygon that exludes the portions outside the given plane.
  */
 
-vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane) {
-	vector<VertexData> output;
+void VertexOps::clipAgainstPlane(const vector<VertexData>& verts, const IPlane& plane,
+	vector<VertexData>& output) {
+	output.clear();
 
-	if (verts.size() > 2) {
-		verts.push_back(verts[0]);
-
-		for (unsigned int i = 1; i < verts.size(); i++) {
-			bool v0In = plane.onFrontSide(verts[i - 1].pos.xyz());
-			bool v1In = plane.onFrontSide(verts[i].pos.xyz());
+	const unsigned int N = (unsigned int)verts.size();
+	if (N > 2) {
+		for (unsigned int i = 1; i <= N; i++) {
+			const VertexData& v0 = verts[i - 1];
+			const VertexData& v1 = verts[i % N];
+			bool v0In = plane.onFrontSide(v0.pos.xyz());
+			bool v1In = plane.onFrontSide(v1.pos.xyz());
 
 			if (v0In && v1In) {
-				output.push_back(verts[i]);
+				output.push_back(v1);
 			} else if (v0In || v1In) {
 				double t;
-				plane.findIntersection(verts[i - 1].pos.xyz(), verts[i].pos.xyz(), t);
-				VertexData I(1.0 - t, verts[i - 1], t, verts[i]);
-				output.push_back(I);
+				plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
+				output.push_back(interpolateClipped(v0, v1, t));
 				if (!v0In && v1In) {
-					output.push_back(verts[i]);
+					output.push_back(v1);
 				}
 			}
 		}
 	}
-	return output;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipPolygon(const vector<VertexData> &clipCoords)
- * @brief	Clip polygon against the normalized view volumn - 2x2x2 cube.
- * @param	clipCoords	The array of triangles.
- * @param	planes		Planes to clip against
- * @return	The array of triangles, after performing clipping.
+ * @fn	void VertexOps::clipPolygon(vector<VertexData>& polygon, const vector<IPlane>& planes,
+ *									int planeMask, vector<VertexData>& scratch)
+ * @brief	Clips a convex polygon against some of several planes, in place.
+ * @param [in,out]	polygon  	The polygon.
+ * @param 		  	planes   	Planes to clip against
+ * @param 		  	planeMask	Bit i is set if the polygon is clipped against planes[i].
+ * @param [in,out]	scratch  	Reused for the output of each plane.
  */
 
-vector<VertexData> VertexOps::clipPolygon(const vector<VertexData>& clipCoords,
-	const vector<IPlane>& planes) {
-	vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 2) {
-		for (unsigned int i = 0; i < clipCoords.size() - 2; i += 3) {
-			vector<VertexData> polygon;
-			polygon.push_back(clipCoords[i]);
-			polygon.push_back(clipCoords[i + 1]);
-			polygon.push_back(clipCoords[i + 2]);
-
-			for (const IPlane& plane : planes) {
-				polygon = clipAgainstPlane(polygon, plane);
-			}
-			if (polygon.size() > 3) {
-				polygon = triangulate(polygon);
-			}
-			for (const VertexData& v : polygon) {
-				ndcCoords.push_back(v);
-			}
+void VertexOps::clipPolygon(vector<VertexData>& polygon, const vector<IPlane>& planes,
+	int planeMask, vector<VertexData>& scratch) {
+	for (size_t i = 0; i < planes.size(); i++) {
+		if ((planeMask & (1 << i)) != 0) {
+			clipAgainstPlane(polygon, planes[i], scratch);
+			polygon.swap(scratch);
 		}
 	}
-	return ndcCoords;
+}
+
+// Outcode bits. The first five match the planes in allButNearNDCPlanes.
+
+const int OUT_RIGHT = 1;		//!< x > 1
+const int OUT_TOP = 2;			//!< y > 1
+const int OUT_FAR = 4;			//!< z > 1
+const int OUT_LEFT = 8;			//!< x < -1
+const int OUT_BOTTOM = 16;		//!< y < -1
+const int OUT_PLANES = 31;		//!< Any of the above
+const int OUT_GUARD_BAND = 32;	//!< Outside the guard band
+
+/**
+ * @fn	static int outcode(const dvec4& pos, double guardBand)
+ * @brief	Computes the outcode of a vertex in normalized device coordinates.
+ * @param	pos		 	The vertex's position.
+ * @param	guardBand	How far x and y can go before the vertex is outside the guard band.
+ * @return	The outcode bits of the planes the vertex is outside of.
+ */
+
+static int outcode(const dvec4& pos, double guardBand) {
+	int code = 0;
+	if (pos.x > 1.0) code |= OUT_RIGHT;
+	if (pos.y > 1.0) code |= OUT_TOP;
+	if (pos.z > 1.0) code |= OUT_FAR;
+	if (pos.x < -1.0) code |= OUT_LEFT;
+	if (pos.y < -1.0) code |= OUT_BOTTOM;
+	if (std::abs(pos.x) > guardBand || std::abs(pos.y) > guardBand) code |= OUT_GUARD_BAND;
+	return code;
 }
 
 /**
@@ -135,11 +156,11 @@ vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData>& clipCoo
 				} else if (v0In && !v1In) {
 					double t;
 					plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
-					v1 = VertexData(1.0 - t, v0, t, v1);
+					v1 = interpolateClipped(v0, v1, t);
 				} else if (!v0In && v1In) {
 					double t;
 					plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
-					v0 = VertexData(1.0 - t, v0, t, v1);
+					v0 = interpolateClipped(v0, v1, t);
 				} else {  // both inside
 					;
 				}
@@ -154,36 +175,26 @@ vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData>& clipCoo
 }
 
 /**
-* @fn	vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData> &triangleVerts,
-*																	 bool renderBackfaces)
-* @brief	Removes the backward facing triangles
-* @param	triangleVerts	The vector of triangle vertices.
-* @return	Vector of triangle vertices, without those facing backward.
+* @fn	bool VertexOps::processBackwardFacingTriangle(VertexData* triangle, bool renderBackfaces)
+* @brief	Culls a backward facing triangle, or flips its normals if backfaces are rendered.
+* @param [in,out]	triangle		The triangle's three vertices.
+* @param 		  	renderBackfaces	True if backfaces are to be rendered.
+* @return	False if the triangle is culled.
 */
 
-vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData>& triangleVerts, bool renderBackfaces) {
-	vector<VertexData> triangles;
-
-	for (int i = 0; i < (int)triangleVerts.size() - 2; i += 3) {
-		dvec3 n = normalFrom3Points(triangleVerts[i].pos.xyz(),
-			triangleVerts[i + 1].pos.xyz(),
-			triangleVerts[i + 2].pos.xyz());
-		if (n.z >= 0.0) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.push_back(triangleVerts[i + 2]);
-		} else if (renderBackfaces) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 2]);
-			triangles.back().normal *= -1;
+bool VertexOps::processBackwardFacingTriangle(VertexData* triangle, bool renderBackfaces) {
+	dvec3 n = normalFrom3Points(triangle[0].pos.xyz(),
+		triangle[1].pos.xyz(),
+		triangle[2].pos.xyz());
+	if (n.z >= 0.0) {
+		return true;
+	} else if (renderBackfaces) {
+		for (int i = 0; i < 3; i++) {
+			triangle[i].normal *= -1;
 		}
+		return true;
 	}
-	return triangles;
+	return false;
 }
 
 /**
@@ -207,7 +218,7 @@ vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const dmat4& m
 		const VertexData& v = vertices[i];
 		dvec3 n = modelingTransfomationForNormals * v.normal;
 		dvec4 worldPos = modelMatrix * v.pos;
-		VertexData vt(worldPos, n, v.material, worldPos.xyz());
+		VertexData vt(worldPos, n, worldPos.xyz());
 		transformedVertices.push_back(vt);
 	}
 	return transformedVertices;
@@ -226,7 +237,7 @@ vector<VertexData> VertexOps::transformVertices(const dmat4& TM, const vector<Ve
 	vector<VertexData> transformedVertices;
 
 	for (const VertexData& v : vertices) {
-		VertexData vt(TM * v.pos, v.normal, v.material);
+		VertexData vt(TM * v.pos, v.normal);
 		// Save the world position separately for use in per pixel lighting calculations
 		vt.worldPos = v.worldPos;
 
@@ -244,73 +255,272 @@ double computeNearPlane(const dmat4& PM) {
 	return nearf;
 }
 
+/**
+ * @fn	static void perspectiveDivide(dvec4& pos)
+ * @brief	Divides a projected position by its w, and keeps 1/w in w, for
+ * 			perspective correct interpolation.
+ * @param [in,out]	pos	The position.
+ */
+
+static void perspectiveDivide(dvec4& pos) {
+	if (pos.w >= 0) {
+		double invW = 1.0 / pos.w;
+		pos = dvec4(pos.xyz() * invW, invW);
+	} else {							// should not happen
+		pos.x /= -pos.w;
+		pos.y /= -pos.w;
+		pos.z = -std::abs(pos.z / -pos.w);
+		pos.w = 1.0 / -pos.w;
+	}
+}
+
+/**
+ * @fn	static dvec4 toWindow(const dmat4& viewportMatrix, const dvec4& pos)
+ * @brief	Maps a divided position to the viewport, keeping its 1/w.
+ * @param	viewportMatrix	The viewport matrix.
+ * @param	pos			  	The position, in normalized device coordinates.
+ * @return	The position in window coordinates.
+ */
+
+static dvec4 toWindow(const dmat4& viewportMatrix, const dvec4& pos) {
+	return dvec4((viewportMatrix * dvec4(pos.xyz(), 1.0)).xyz(), pos.w);
+}
+
+/**
+ * @fn	double VertexOps::getGuardBand(const FrameBuffer& frameBuffer, const dmat4& viewportMatrix)
+ * @brief	Gets the guard band for a viewport. The rasterizer only clips to the
+ * 			window, so triangles can only be left unclipped if the viewport
+ * 			covers the whole window.
+ * @param	frameBuffer   	The frame buffer.
+ * @param	viewportMatrix	The viewport matrix.
+ * @return	GUARD_BAND, or 1 if there can be no guard band.
+ */
+
+double VertexOps::getGuardBand(const FrameBuffer& frameBuffer, const dmat4& viewportMatrix) {
+	dvec4 lowerLeft = viewportMatrix * dvec4(-1.0, -1.0, 0.0, 1.0);
+	dvec4 upperRight = viewportMatrix * dvec4(1.0, 1.0, 0.0, 1.0);
+	bool fillsWindow = lowerLeft.x == 0.0 && lowerLeft.y == 0.0 &&
+		upperRight.x == frameBuffer.getWindowWidth() && upperRight.y == frameBuffer.getWindowHeight();
+	return fillsWindow ? GUARD_BAND : 1.0;
+}
+
+/**
+ * @fn	void VertexOps::emitNearClipped(const dmat4& viewportMatrix, double guardBand,
+ *										const Material* material, bool renderBackfaces)
+ * @brief	Finishes a triangle that has been clipped against the near plane,
+ * 			projected and divided, and is in buffers.nearClipped. The polygon is
+ * 			convex, so it is drawn as a fan. A triangle of the fan is dropped if
+ * 			its vertices' outcodes put them all outside the same plane, or if it
+ * 			faces backward. It is only clipped if it crosses the far plane or
+ * 			leaves the guard band; otherwise the rasterizer's bounds trim it.
+ * 			The triangles are mapped to the viewport and added to
+ * 			buffers.windowCoords, and their material to buffers.windowMaterials.
+ * @param	viewportMatrix 	The viewport matrix.
+ * @param	guardBand	   	From getGuardBand.
+ * @param	material	   	The triangle's material.
+ * @param	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::emitNearClipped(const dmat4& viewportMatrix, double guardBand,
+	const Material* material, bool renderBackfaces) {
+	PipelineBuffers& b = buffers;
+	const int N = (int)b.nearClipped.size();
+	int* codes = b.outcodes;
+	for (int i = 0; i < N; i++) {
+		codes[i] = outcode(b.nearClipped[i].pos, guardBand);
+	}
+	for (int k = 1; k + 1 < N; k++) {
+		if ((codes[0] & codes[k] & codes[k + 1] & OUT_PLANES) != 0) {
+			continue;
+		}
+		const int crossed = codes[0] | codes[k] | codes[k + 1];
+
+		b.polygon.clear();
+		b.polygon.push_back(b.nearClipped[0]);
+		b.polygon.push_back(b.nearClipped[k]);
+		b.polygon.push_back(b.nearClipped[k + 1]);
+		if (!processBackwardFacingTriangle(b.polygon.data(), renderBackfaces)) {
+			continue;
+		}
+
+		if ((crossed & (OUT_FAR | OUT_GUARD_BAND)) != 0) {
+			clipPolygon(b.polygon, allButNearNDCPlanes, crossed & OUT_PLANES, b.scratch);
+		} else {
+			// Put the vertices in the order clipping against all five planes
+			// would have left them in, so the rasterizer sees the same triangle.
+			std::rotate(b.polygon.begin(), b.polygon.begin() + 2, b.polygon.end());
+		}
+		for (VertexData& v : b.polygon) {
+			v.pos = toWindow(viewportMatrix, v.pos);
+		}
+		for (size_t m = 1; m + 1 < b.polygon.size(); m++) {
+			b.windowCoords.push_back(b.polygon[0]);
+			b.windowCoords.push_back(b.polygon[m]);
+			b.windowCoords.push_back(b.polygon[m + 1]);
+			b.windowMaterials.push_back(material);
+		}
+	}
+}
+
 /**
  * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *												const vector<LightSourcePtr> &lights,
- *												const vector<VertexData> &objectCoords)
+ *												const vector<VertexData> &objectCoords,
+ *												const Material &material)
  * @brief	Transforms the triangle vertices through pipeline:
  *					object -> world -> eye -> clip/ndc -> window.
+ * 			Each triangle goes through every stage before the next one starts,
+ * 			using the reused PipelineBuffers, so no stage allocates.
  * @param [in,out]	frameBuffer 	Buffer for frame data.
  * @param 		  	eyePos			The eye position.
  * @param 		  	lights			The lights.
  * @param 		  	objectCoords	The object coordinates.
+ * @param 		  	material		The material of every triangle.
  */
 
 void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& objectCoords,
+	const Material& material,
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats,
 	bool renderBackfaces) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
 	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
-	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+	// Create 3 x 3 matrix for transforming normal vectors to world coordinates
+	dmat3 TM3x3(modelingMatrix);
+	dmat3 modelingTransfomationForNormals = glm::transpose(glm::inverse(TM3x3));
 
 	double nearZ = computeNearPlane(projectionMatrix);
-	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
-	vector<VertexData> eyeCoordsClippedOnNearPlane = clipPolygon(eyeCoords, nearPlane);
+	IPlane nearPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS);
+	double guardBand = getGuardBand(frameBuffer, pipeMats.viewportMatrix);
+
+	PipelineBuffers& b = buffers;
+	b.windowCoords.clear();
+	b.windowMaterials.clear();
+	for (size_t i = 0; i + 2 < objectCoords.size(); i += 3) {
+		b.polygon.clear();
+		for (size_t j = i; j < i + 3; j++) {
+			const VertexData& v = objectCoords[j];
+			dvec4 worldPos = modelingMatrix * v.pos;
+			b.polygon.push_back(VertexData(viewingMatrix * worldPos,
+				modelingTransfomationForNormals * v.normal, worldPos.xyz()));
+		}
+		clipAgainstPlane(b.polygon, nearPlane, b.nearClipped);
+		for (VertexData& v : b.nearClipped) {
+			v.pos = projectionMatrix * v.pos;
+			perspectiveDivide(v.pos);
+		}
+		emitNearClipped(pipeMats.viewportMatrix, guardBand, &material, renderBackfaces);
+	}
 
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
-	vector<VertexData> clipCoords;
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, b.windowCoords, b.windowMaterials, eyeFrame);
+}
 
-	for (VertexData v : projCoords) {		// Perspective division
-		if (v.pos.w >= 0) {
-			v.pos /= v.pos.w;
-		} else {							// should not happen
-			v.pos.x /= -v.pos.w;
-			v.pos.y /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z / -v.pos.w);
-			v.pos.w = 1.0;
+/**
+ * @fn	void VertexOps::processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+ *												const vector<LightSourcePtr>& lights,
+ *												const EMeshData& mesh,
+ *												const dmat4& modelingMatrix,
+ *												const PipelineMatrices& pipeMats,
+ *												bool renderBackfaces)
+ * @brief	Draws an indexed mesh through the same pipeline as processTriangleVertices.
+ * 			Every vertex is transformed to eye coordinates once, and, if it is in
+ * 			front of the near plane, projected and divided once; the results are
+ * 			cached for all of the triangles that share it. Only triangles that
+ * 			cross the near plane are clipped and projected vertex by vertex.
+ * @param [in,out]	frameBuffer	  	Buffer for frame data.
+ * @param 		  	eyePos		  	The eye position.
+ * @param 		  	lights		  	The lights.
+ * @param 		  	mesh		  	The mesh, in object coordinates.
+ * @param 		  	modelingMatrix	The transformation applied to the object.
+ * @param 		  	pipeMats	  	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const EMeshData& mesh,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
+
+	dmat3 TM3x3(modelingMatrix);
+	dmat3 modelingTransfomationForNormals = glm::transpose(glm::inverse(TM3x3));
+
+	double nearZ = computeNearPlane(projectionMatrix);
+	IPlane nearPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS);
+	double guardBand = getGuardBand(frameBuffer, pipeMats.viewportMatrix);
+
+	// The post-transform cache
+	PipelineBuffers& b = buffers;
+	const size_t N = mesh.vertices.size();
+	b.eyeCoords.clear();
+	b.ndcCoords.resize(N);
+	b.inFront.resize(N);
+	for (size_t i = 0; i < N; i++) {
+		const EVertex& v = mesh.vertices[i];
+		dvec4 worldPos = modelingMatrix * dvec4(dvec3(v.pos), 1.0);
+		b.eyeCoords.push_back(VertexData(viewingMatrix * worldPos,
+			modelingTransfomationForNormals * dvec3(v.normal), worldPos.xyz()));
+		b.inFront[i] = nearPlane.onFrontSide(b.eyeCoords[i].pos.xyz());
+		if (b.inFront[i]) {
+			b.ndcCoords[i] = projectionMatrix * b.eyeCoords[i].pos;
+			perspectiveDivide(b.ndcCoords[i]);
 		}
-		clipCoords.push_back(v);
 	}
 
-	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);
-
-	vector<VertexData> ndcCoords = clipPolygon(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+	b.windowCoords.clear();
+	b.windowMaterials.clear();
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const unsigned int* triangle = &mesh.indices[i];
+		if (b.inFront[triangle[0]] && b.inFront[triangle[1]] && b.inFront[triangle[2]]) {
+			// Clipping would keep all three, starting from the second.
+			b.nearClipped.clear();
+			for (int k : { 1, 2, 0 }) {
+				b.nearClipped.push_back(b.eyeCoords[triangle[k]]);
+				b.nearClipped.back().pos = b.ndcCoords[triangle[k]];
+			}
+		} else {
+			b.polygon.clear();
+			for (int k = 0; k < 3; k++) {
+				b.polygon.push_back(b.eyeCoords[triangle[k]]);
+			}
+			clipAgainstPlane(b.polygon, nearPlane, b.nearClipped);
+			for (VertexData& v : b.nearClipped) {
+				v.pos = projectionMatrix * v.pos;
+				perspectiveDivide(v.pos);
+			}
+		}
+		emitNearClipped(pipeMats.viewportMatrix, guardBand,
+			&mesh.materials[mesh.triangleMaterials[i / 3]], renderBackfaces);
+	}
 
 	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, b.windowCoords, b.windowMaterials, eyeFrame);
 }
 
 /**
  * @fn	void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *											const vector<LightSourcePtr> &lights,
- *											const vector<VertexData> &objectCoords)
+ *											const vector<VertexData> &objectCoords,
+ *											const Material &material)
  * @brief	Process the line segments through the pipeline.
  * @param [in,out]	frameBuffer 	Frame buffer
  * @param 		  	eyePos			Eye position.
  * @param 		  	lights			The lights in the scene.
  * @param 		  	objectCoords	The vector of object coordinates.
+ * @param 		  	material		The material of every line.
  */
 
 void VertexOps::processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& objectCoords,
+	const Material& material,
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
@@ -323,28 +533,27 @@ void VertexOps::processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePo
 	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoords);
 	vector<VertexData> clipCoords;
 
-	for (VertexData v : projCoords) {	// Perspective division
-		if (v.pos.w >= 0)
-			v.pos /= v.pos.w;
-		else {							// this should not happen
-			v.pos /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z);
-		}
+	for (VertexData v : projCoords) {
+		perspectiveDivide(v.pos);
 		clipCoords.push_back(v);
 	}
 
-	vector<VertexData> ndcCoords = clipLineSegments(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+	vector<VertexData> windowCoords = clipLineSegments(clipCoords, allButNearNDCPlanes);
+	for (VertexData& v : windowCoords) {
+		v.pos = toWindow(viewportMatrix, v.pos);
+	}
 	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyLines(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+	drawManyLines(frameBuffer, eyePos, lights, windowCoords, material, eyeFrame);
 }
 
 /**
  * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+ *								const Material &material,
  *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
- * @brief	Renders this object
+ * @brief	Renders this object, with one material bound for all of it
  * @param [in,out]	frameBuffer	Buffer for frame data.
  * @param 		  	verts	   	The vertices.
+ * @param 		  	material   	The material.
  * @param 		  	lights	   	The lights.
  * @param           modelingMatrix  The transformation applied to the object
  * @param 		  	pipeMats    The pipeline matrices
@@ -352,6 +561,7 @@ void VertexOps::processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePo
  */
 
 void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts,
+	const Material& material,
 	const vector<LightSourcePtr>& lights,
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats,
@@ -359,7 +569,29 @@ void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
 
 	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
-	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts,
+	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts, material,
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const EMeshData &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
+ * @brief	Renders an indexed mesh
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, const EMeshData& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	dvec3 eyePos = glm::inverse(pipeMats.viewingMatrix)[3].xyz();
+	VertexOps::processIndexedTriangles(frameBuffer, eyePos, lights, mesh,
 		modelingMatrix, pipeMats, renderBackfaces);
 }
 
@@ -15,6 +15,7 @@
 #include "vertexdata.h"
 #include "iscene.h"
 #include "rasterization.h"
+#include "eshape.h"
 
  /**
   * @class	PipelineMatrices
@@ -27,6 +28,26 @@ struct PipelineMatrices {
 	dmat4 viewportMatrix;
 };
 
+const double GUARD_BAND = 4.0;	//!< Triangles within x, y in [-4, 4] in NDC are not clipped.
+
+/**
+ * @struct	PipelineBuffers
+ * @brief	Vertex buffers the triangle pipeline reuses from call to call. Once
+ * 			they have grown to fit a scene, drawing it does not allocate.
+ */
+
+struct PipelineBuffers {
+	vector<VertexData> nearClipped;		//!< A triangle, clipped against the near plane
+	vector<VertexData> polygon;			//!< A triangle being clipped against the NDC planes
+	vector<VertexData> scratch;			//!< Output of clipping against a single plane
+	vector<VertexData> windowCoords;	//!< Triangles ready for the rasterizer
+	vector<const Material*> windowMaterials;	//!< ... and the material of each
+	vector<VertexData> eyeCoords;		//!< Each vertex of an indexed mesh, in eye coordinates
+	vector<dvec4> ndcCoords;			//!< ... projected and divided, if it is in front of the near plane
+	vector<unsigned char> inFront;		//!< Nonzero if the vertex is in front of the near plane
+	int outcodes[4];					//!< Outcodes of nearClipped, which has at most four vertices
+};
+
 /**
  * @class	VertexOps
  * @brief	Class to encapsulate the methods related to vertex processing for Pipeline graphics.
@@ -39,29 +60,47 @@ public:
 	static void processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
 		const vector<VertexData>& objectCoords,
+		const Material& material,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const EMeshData& mesh,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces);
 	static void processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
 		const vector<VertexData>& objectCoords,
+		const Material& material,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats);
 	static void render(FrameBuffer& frameBuffer, const vector<VertexData>& verts,
+		const Material& material,
 		const vector<LightSourcePtr>& lights,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces
 	);
+	static void render(FrameBuffer& frameBuffer, const EMeshData& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
 protected:
-	static vector<VertexData> clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane);
-	static vector<VertexData> clipPolygon(const vector<VertexData>& clipCoords,
-		const vector<IPlane>& planes);
+	static thread_local PipelineBuffers buffers;	//!< Reused by processTriangleVertices
+	static void clipAgainstPlane(const vector<VertexData>& verts, const IPlane& plane,
+		vector<VertexData>& output);
+	static void clipPolygon(vector<VertexData>& polygon, const vector<IPlane>& planes,
+		int planeMask, vector<VertexData>& scratch);
 	static vector<VertexData> clipLineSegments(const vector<VertexData>& clipCoords,
 		const vector<IPlane>& planes);
-	static vector<VertexData> processBackwardFacingTriangles(const vector<VertexData>& triangleVerts,
-		bool renderBackfaces);
+	static bool processBackwardFacingTriangle(VertexData* triangle, bool renderBackfaces);
+	static double getGuardBand(const FrameBuffer& frameBuffer, const dmat4& viewportMatrix);
+	static void emitNearClipped(const dmat4& viewportMatrix, double guardBand,
+		const Material* material, bool renderBackfaces);
 	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4& modelMatrix,
 		const vector<VertexData>& vertices);
 	static vector<VertexData> transformVertices(const dmat4& TM, const vector<VertexData>& vertices);
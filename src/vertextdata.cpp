@@ -12,20 +12,17 @@
 #include "ishape.h"
 
  /**
-  * @fn	VertexData::VertexData(const dvec4 &P, const dvec3 &norm,
-								 const Material &mat, const dvec3 &WP)
+  * @fn	VertexData::VertexData(const dvec4 &P, const dvec3 &norm, const dvec3 &WP)
   * @brief	Constructor
   * @param	P			Current coordinate.
   * @param	norm		Normal vector
-  * @param	mat			Material
   * @param	WP			World position.
   */
 
 VertexData::VertexData(const dvec4& P,
 	const dvec3& norm,
-	const Material& mat,
 	const dvec3& WP) :
-	pos(P), normal(glm::normalize(norm)), material(mat), worldPos(WP) {
+	pos(P), normal(glm::normalize(norm)), worldPos(WP) {
 }
 
 /**
@@ -41,32 +38,28 @@ VertexData::VertexData(double w1, const VertexData& vd1,
 	double w2, const VertexData& vd2)
 	: pos(weightedAverage(w1, vd1.pos, w2, vd2.pos)),
 	normal(weightedAverage(w1, vd1.normal, w2, vd2.normal)),
-	material(weightedAverage(w1, vd1.material, w2, vd2.material)),
 	worldPos(weightedAverage(w1, vd1.worldPos, w2, vd2.worldPos)) {
 }
 
 /**
  * @fn	void VertexData::addTriVertsAndComputeNormal(vector<VertexData> &verts,
- *													const dvec4 &V1, const dvec4 &V2, const dvec4 &V3,
- *													const Material &mat)
+ *													const dvec4 &V1, const dvec4 &V2, const dvec4 &V3)
  * @brief	Adds a triangle vertices and computes normal, adding vertices to end of verts.
  *          Vertices are specified in counterclockwise order.
  * @param [in,out]	verts	The vector of vertices.
  * @param 		  	V1   	The first vertice
  * @param 		  	V2   	The second vertice.
  * @param 		  	V3   	The third vertice.
- * @param 		  	mat  	Material.
  */
 
 void VertexData::addTriVertsAndComputeNormal(vector<VertexData>& verts,
 	const dvec4& V1,
 	const dvec4& V2,
-	const dvec4& V3,
-	const Material& mat) {
+	const dvec4& V3) {
 	dvec3 n = normalFrom3Points(V1.xyz(), V2.xyz(), V3.xyz());
-	verts.push_back(VertexData(V1, n, mat));
-	verts.push_back(VertexData(V2, n, mat));
-	verts.push_back(VertexData(V3, n, mat));
+	verts.push_back(VertexData(V1, n));
+	verts.push_back(VertexData(V2, n));
+	verts.push_back(VertexData(V3, n));
 }
 
 /**
@@ -78,7 +71,7 @@ void VertexData::addTriVertsAndComputeNormal(vector<VertexData>& verts,
  */
 
 VertexData operator * (double w, const VertexData& data) {
-	VertexData result(w * data.pos, w * data.normal, w * data.material, w * data.worldPos);
+	VertexData result(w * data.pos, w * data.normal, w * data.worldPos);
 	return result;
 }
 
@@ -91,7 +84,6 @@ VertexData operator * (double w, const VertexData& data) {
 
 VertexData VertexData::operator + (const VertexData& other) const {
 	VertexData result(*this);
-	result.material += other.material;
 	result.normal += other.normal;
 	result.pos += other.pos;
 	result.worldPos += other.worldPos;